@@ -1,12 +1,86 @@
 #include "stdafx.h"
 #include <iosfwd>
+#include <algorithm>
+#include <stdint.h>
 #include <zip.h>
 #include "ZipArchive.h"
+#include "ZipBufferSource.h"
+#include "ZipCompactor.h"
+#include "ZipDirectory.h"
+#include "ZipDuplicateFinder.h"
+#include "ZipEntryOrder.h"
+#include "ZipFileOutput.h"
+#include "ZipFormat.h"
+#include "ZipReadahead.h"
 
 using namespace std;
 
+static volatile LONGLONG nextSerial = 0;
+
+namespace
+{
+	// orders entry indices by local header offset, entries added since open go last
+	struct OffsetLess
+	{
+		const CZipDirectory &directory;
+
+		OffsetLess(const CZipDirectory &directory) : directory(directory) {}
+
+		zip_uint64_t offset(zip_uint64_t index) const
+		{
+			return index < directory.getCount() ? directory.getEntry((size_t)index).offset : ZIP_UINT64_MAX;
+		}
+
+		bool operator()(zip_uint64_t a, zip_uint64_t b) const
+		{
+			return offset(a) < offset(b);
+		}
+	};
+
+	// lets readLimited grow a vector the way it grows a CZipBuffer, the size follows the length
+	class VectorBuffer
+	{
+	public:
+		VectorBuffer(vector<char> &data) : data(data) {}
+
+		bool reserve(size_t capacity)
+		{
+			if (data.size() < capacity)
+				data.resize(capacity);
+			return true;
+		}
+
+		void setLength(size_t length)
+		{
+			data.resize(length);
+		}
+
+		char *getData(void)
+		{
+			return data.empty() ? NULL : &data[0];
+		}
+
+	private:
+		vector<char> &data;
+
+		VectorBuffer &operator=(const VectorBuffer &);
+	};
+}
+
 CZipArchive::CZipArchive(const std::string &zipPath, bool isUtf8 /*= false*/, const std::string &password /*= ""*/) : path(zipPath), isUtf8(isUtf8),
-zipHandle(NULL), mode(NOT_OPEN), password(password)
+buffer(NULL), zipHandle(NULL), mode(NOT_OPEN), password(password), cache(NULL), serial(0), generation(0),
+rawDirectory(NULL), rawInput(NULL), rawFile(INVALID_HANDLE_VALUE), rawFailed(false),
+memoryLimit(0), maxRatio(0), lastReadError(READ_OK),
+compactOnClose(false), onlyDeletes(true), fileOutput(NULL), memoryResource(NULL), entryOrder(NULL)
+{
+
+}
+
+CZipArchive::CZipArchive(std::vector<char> &buffer, bool isUtf8 /*= false*/, const std::string &password /*= ""*/) : isUtf8(isUtf8),
+buffer(&buffer), zipHandle(NULL), mode(NOT_OPEN), password(password), cache(NULL), serial(0), generation(0),
+rawDirectory(NULL), rawInput(NULL), rawFile(INVALID_HANDLE_VALUE), rawFailed(false),
+memoryLimit(0), maxRatio(0), lastReadError(READ_OK),
+compactOnClose(false), onlyDeletes(true), fileOutput(NULL), memoryResource(NULL), entryOrder(NULL)
 {
 
 }
@@ -32,7 +106,29 @@ bool CZipArchive::open(OpenMode mode, bool checkConsistency)
 		zipFlag = zipFlag | ZIP_CHECKCONS;
 
 	int errorFlag = 0;
-	zipHandle = zip_open(path.c_str(), zipFlag, &errorFlag);
+	if (buffer != NULL)
+	{
+		zip_error_t error;
+		zip_error_init(&error);
+		zip_source *source = CreateZipBufferSource(*buffer, &error);
+		if (source != NULL)
+		{
+			zipHandle = zip_open_from_source(source, zipFlag, &error);
+			if (zipHandle == NULL)
+				zip_source_free(source);
+		}
+		errorFlag = zip_error_code_zip(&error);
+		zip_error_fini(&error);
+	}
+	else
+	{
+		// finish a compaction interrupted by a crash, the archive is unreadable until then
+		CZipCompactor compactor(path);
+		if (compactor.hasJournal() && !compactor.recover())
+			return false;
+
+		zipHandle = zip_open(path.c_str(), zipFlag, &errorFlag);
+	}
 
 	if (errorFlag != ZIP_ER_OK)
 	{
@@ -53,29 +149,163 @@ bool CZipArchive::open(OpenMode mode, bool checkConsistency)
 		}
 
 		this->mode = mode;
+		serial = (zip_uint64_t)InterlockedIncrement64(&nextSerial);
+		generation = 1;
+		onlyDeletes = true;
 		return true;
 	}
 
 	return false;
 }
 
-void CZipArchive::close(void)
+bool CZipArchive::close(void)
 {
+	bool result = true;
 	if (zipHandle)
 	{
-		zip_close(zipHandle);
+		if (cache != NULL)
+			cache->erase(serial);
+		closeRaw();
+
+		// libzip writes the central directory in index order
+		vector<string> names;
+		bool arrange = entryOrder != NULL && entryOrder->getPolicy() != CZipEntryOrder::ORIGINAL && mode != READ_ONLY;
+		if (arrange)
+		{
+			vector<CZipEntry> entries = getEntries();
+			for (vector<CZipEntry>::const_iterator it = entries.begin(); it != entries.end(); ++it)
+				names.push_back(it->getName());
+		}
+
+		CompactResult compacted = compactOnClose ? compact() : COMPACT_SKIPPED;
+		if (compacted == COMPACT_FAILED)
+		{
+			result = false;
+		}
+		else if (compacted == COMPACT_SKIPPED)
+		{
+			// a failed zip_close leaves the archive open
+			if (zip_close(zipHandle) != 0)
+			{
+				zip_discard(zipHandle);
+				result = false;
+			}
+		}
 		zipHandle = NULL;
 		mode = NOT_OPEN;
+		arena.clear();
+		closeShared();
+
+		// the archive written by libzip is kept when this fails, only the order is lost
+		if (result && arrange && !arrangeEntries(names))
+			result = false;
+	}
+	return result;
+}
+
+CZipArchive::CompactResult CZipArchive::compact(void)
+{
+	if (buffer != NULL || mode != WRITE || !onlyDeletes)
+		return COMPACT_SKIPPED;
+
+	// deleted entries fail to stat in the CURRENT state
+	zip_int64_t count = zip_get_num_entries(zipHandle, ZIP_FL_UNCHANGED);
+	vector<bool> keep(count > 0 ? (size_t)count : 0);
+	size_t kept = 0;
+	for (size_t i = 0; i < keep.size(); ++i)
+	{
+		struct zip_stat stat;
+		keep[i] = zip_stat_index(zipHandle, i, 0, &stat) == 0;
+		if (keep[i])
+			++kept;
+	}
+
+	// nothing to move, or libzip removes the whole file
+	if (kept == keep.size() || kept == 0)
+		return COMPACT_SKIPPED;
+
+	zip_discard(zipHandle);
+	zipHandle = NULL;
+
+	CZipCompactor compactor(path);
+	if (compactor.compact(keep))
+		return COMPACT_DONE;
+
+	// the file was being changed, it can only be rolled forward;
+	// if that fails too the journal stays and the next open retries
+	if (compactor.hasJournal())
+		return compactor.recover() ? COMPACT_DONE : COMPACT_FAILED;
+
+	// the file is untouched, delete the entries again and let libzip rewrite it
+	int errorFlag = 0;
+	zipHandle = zip_open(path.c_str(), 0, &errorFlag);
+	if (zipHandle == NULL)
+		return COMPACT_FAILED;    //the deletions are lost
+
+	if (isEncrypted())
+		zip_set_default_password(zipHandle, password.c_str());
+	for (size_t i = 0; i < keep.size(); ++i)
+	{
+		if (!keep[i] && zip_delete(zipHandle, i) != 0)
+		{
+			zip_discard(zipHandle);
+			zipHandle = NULL;
+			return COMPACT_FAILED;
+		}
 	}
+	return COMPACT_SKIPPED;
+}
+
+bool CZipArchive::arrangeEntries(const vector<string> &names)
+{
+	// libzip removes an archive left without entries
+	if (names.empty())
+		return true;
+
+	CZipDirectory directory;
+	if (!readDirectory(directory) || directory.getCount() != names.size())
+		return false;
+
+	vector<zip_uint64_t> sizes(names.size());
+	for (size_t i = 0; i < sizes.size(); ++i)
+		sizes[i] = directory.getEntry(i).size;
+
+	vector<size_t> order;
+	entryOrder->arrange(names, sizes, order);
+
+	size_t i = 0;
+	while (i < order.size() && order[i] == i)
+		++i;
+	if (i == order.size())
+		return true;
+
+	if (buffer != NULL)
+	{
+		vector<char> arranged;
+		CZipBufferRandomInput input(&(*buffer)[0], buffer->size());
+		CZipBufferOutputStream output(arranged);
+		if (!CZipEntryOrder::rewrite(input, order, output))
+			return false;
+
+		buffer->swap(arranged);
+		return true;
+	}
+
+	return CZipEntryOrder::rewrite(path, order);
 }
 
 void CZipArchive::discard(void)
 {
 	if (zipHandle)
 	{
+		if (cache != NULL)
+			cache->erase(serial);
+		closeRaw();
 		zip_discard(zipHandle);
 		zipHandle = NULL;
 		mode = NOT_OPEN;
+		arena.clear();
+		closeShared();
 	}
 }
 
@@ -84,6 +314,12 @@ bool CZipArchive::unlink(void)
 	if (isOpen())
 		discard();
 
+	if (buffer != NULL)
+	{
+		vector<char>().swap(*buffer);
+		return true;
+	}
+
 	int result = remove(path.c_str());
 	return result == 0;
 }
@@ -113,6 +349,7 @@ bool CZipArchive::setComment(const string &comment) const
 	string realComment = AsciiToUtf8(comment);
 	int size = realComment.size();
 	const char *data = realComment.c_str();
+	onlyDeletes = false;
 	int result = zip_set_archive_comment(zipHandle, data, size);
 	return result == 0;
 }
@@ -153,9 +390,11 @@ vector<CZipEntry> CZipArchive::getEntries(State state) const
 	zip_stat_init(&stat);  
 
 	vector<CZipEntry> entries;
-	// ֱӷzipԭļ
+	// 直接返回zip中原生编码的文件名
 	int flag = (state == ORIGINAL) ? ZIP_FL_UNCHANGED : 0;
 	zip_int64_t nbEntries = getNbEntries(state);
+	if (nbEntries > 0)
+		entries.reserve((size_t)nbEntries);
 	for (zip_int64_t i = 0 ; i < nbEntries ; ++i)
 	{
 		int result = zip_stat_index(zipHandle, i, flag, &stat);
@@ -168,6 +407,93 @@ vector<CZipEntry> CZipArchive::getEntries(State state) const
 	return entries;
 }
 
+vector<CZipEntry> CZipArchive::getEntries(const CZipEntryFilter &filter, State state) const
+{
+	vector<zip_uint64_t> indices;
+	selectEntries(filter, indices, state);
+
+	vector<CZipEntry> entries;
+	vector<zip_uint64_t>::const_iterator it;
+	for (it = indices.begin(); it != indices.end(); ++it)
+	{
+		CZipEntry entry = getEntry((zip_int64_t)*it, state);
+		if (!entry.isNull())
+			entries.push_back(entry);
+	}
+	return entries;
+}
+
+static void FillEntryView(const struct zip_stat &stat, CZipEntryView &view)
+{
+	view.name = stat.name;
+	view.index = stat.index;
+	view.size = stat.size;
+	view.sizeComp = stat.comp_size;
+	view.time = stat.mtime;
+	view.method = stat.comp_method;
+}
+
+void CZipArchive::selectEntries(const CZipEntryFilter &filter, vector<zip_uint64_t> &indices, State state) const
+{
+	if (!isOpen())
+		return;
+
+	filter.compile(isUtf8);
+
+	struct zip_stat stat;
+	zip_stat_init(&stat);
+	CZipEntryView view;
+
+	int flag = (state == ORIGINAL) ? ZIP_FL_UNCHANGED : 0;
+
+	// 不含通配符的模式直接按名称定位，不遍历条目
+	if (filter.isLiteral())
+	{
+		const vector<string> &literals = filter.getLiterals();
+		vector<string>::const_iterator it;
+		for (it = literals.begin(); it != literals.end(); ++it)
+		{
+			zip_int64_t index = zip_name_locate(zipHandle, it->c_str(), flag | DEFAULLT_ENC_FLAG);
+			if (index < 0)
+				continue;
+
+			if (filter.hasPredicate())
+			{
+				if (zip_stat_index(zipHandle, index, flag, &stat) != 0)
+					continue;
+
+				FillEntryView(stat, view);
+				if (!filter.acceptView(view))
+					continue;
+			}
+			indices.push_back(index);
+		}
+
+		sort(indices.begin(), indices.end());
+		indices.erase(unique(indices.begin(), indices.end()), indices.end());
+		return;
+	}
+
+	zip_int64_t nbEntries = getNbEntries(state);
+	for (zip_int64_t i = 0; i < nbEntries; ++i)
+	{
+		const char *name = zip_get_name(zipHandle, i, flag);
+		if (name == NULL || !filter.matchName(name))
+			continue;
+
+		if (filter.hasPredicate())
+		{
+			if (zip_stat_index(zipHandle, i, flag, &stat) != 0)
+				continue;
+
+			FillEntryView(stat, view);
+			if (!filter.acceptView(view))
+				continue;
+		}
+		indices.push_back(i);
+	}
+}
+
 bool CZipArchive::hasEntry(const string &name, bool excludeDirectories, bool caseSensitive, State state) const
 {
 	CZipEntry entry = getEntry(name, excludeDirectories, caseSensitive, state);
@@ -223,85 +549,519 @@ string CZipArchive::getEntryComment(const CZipEntry &entry, State state) const
 	if (state == ORIGINAL)
 		flag = flag | ZIP_FL_UNCHANGED;
 
-	unsigned int clen;
-	const char *com = zip_file_get_comment(zipHandle, entry.getIndex(), &clen, flag);
-	string comment = com == NULL ? string() : string(com, clen);
-	return Utf8ToAscii(comment);
+	unsigned int clen;
+	const char *com = zip_file_get_comment(zipHandle, entry.getIndex(), &clen, flag);
+	string comment = com == NULL ? string() : string(com, clen);
+	return Utf8ToAscii(comment);
+}
+
+bool CZipArchive::setEntryComment(const CZipEntry &entry, const string &comment) const
+{
+	if (!isOpen())
+		return false;
+
+	if (entry.zipFile != this)
+		return false;
+	
+	onlyDeletes = false;
+	string realComment = AsciiToUtf8(comment);
+	int result = zip_file_set_comment(zipHandle, entry.getIndex(), realComment.c_str(), realComment.size(), DEFAULLT_ENC_FLAG);
+	return result == 0;
+}
+
+void *CZipArchive::readEntry(const CZipEntry &zipEntry, bool asText, State state) const
+{
+	lastReadError = READ_FAILED;
+
+	if (zipEntry.isNull())
+		return NULL;
+
+	if (!isOpen())
+		return NULL;
+
+	if (zipEntry.zipFile != this)
+		return NULL;
+
+	return readIndex(zipEntry.getIndex(), zipEntry.getSize(), asText, state);
+}
+
+void *CZipArchive::readIndex(zip_uint64_t index, zip_uint64_t size, bool asText, State state) const
+{
+	// the default resource allocates with new[], so callers keep using delete[]
+	CZipBuffer data(CZipMemoryResource::getDefault());
+	if (!readIndex(index, size, asText, state, data))
+		return NULL;
+
+	return data.release();
+}
+
+bool CZipArchive::readIndex(zip_uint64_t index, zip_uint64_t size, bool asText, State state, CZipBuffer &data) const
+{
+	if (cache == NULL)
+		return readLimited(index, size, asText, state, data);
+
+	CZipEntryCache::Buffer content = readCached(index, size, state);
+	if (!content)
+		return false;
+
+	data.setLength(0);
+	if (!data.reserve(content->size() + (asText ? 1 : 0)))
+	{
+		lastReadError = READ_FAILED;
+		return false;
+	}
+
+	if (!content->empty())
+		memcpy(data.getData(), &(*content)[0], content->size());
+	if (asText)
+		data.getData()[content->size()] = '\0';
+	data.setLength(content->size());
+	return true;
+}
+
+bool CZipArchive::readEntry(const CZipEntry &zipEntry, CZipBuffer &buffer, bool asText, State state) const
+{
+	lastReadError = READ_FAILED;
+	buffer.setLength(0);
+
+	if (zipEntry.isNull() || !isOpen() || zipEntry.zipFile != this)
+		return false;
+
+	return readIndex(zipEntry.getIndex(), zipEntry.getSize(), asText, state, buffer);
+}
+
+bool CZipArchive::readEntry(const std::string &zipEntry, CZipBuffer &buffer, bool asText, State state) const
+{
+	return readEntry(getEntry(zipEntry), buffer, asText, state);
+}
+
+CZipArchive::ReadError CZipArchive::checkLimits(zip_uint64_t index, zip_uint64_t size, State state, bool inMemory) const
+{
+	if (inMemory && memoryLimit > 0 && size > memoryLimit)
+		return READ_TOO_LARGE;
+
+	// a buffer cannot hold it on a 32-bit build, the sizes would wrap below
+	if (inMemory && size >= SIZE_MAX)
+		return READ_TOO_LARGE;
+
+	if (maxRatio > 0)
+	{
+		int flag = state == ORIGINAL ? ZIP_FL_UNCHANGED : 0;
+		struct zip_stat stat;
+		zip_stat_init(&stat);
+
+		// data added in this session has no compressed size yet
+		if (zip_stat_index(zipHandle, index, flag, &stat) == 0 && (stat.valid & ZIP_STAT_COMP_SIZE) != 0 &&
+			stat.comp_method != ZIP_CM_STORE && size / maxRatio > stat.comp_size)
+			return READ_RATIO_EXCEEDED;
+	}
+
+	return READ_OK;
+}
+
+template <class Buffer>
+bool CZipArchive::readLimited(zip_uint64_t index, zip_uint64_t size, bool asText, State state, Buffer &data,
+	CZipReadahead *readahead /*= NULL*/) const
+{
+	data.setLength(0);
+	lastReadError = checkLimits(index, size, state, true);
+	if (lastReadError != READ_OK)
+		return false;
+
+	lastReadError = READ_FAILED;
+	int flag = state == ORIGINAL ? ZIP_FL_UNCHANGED : 0;
+	struct zip_file *zipFile = zip_fopen_index(zipHandle, index, flag);
+	if (!zipFile)
+		return false;
+
+	// grow with the data actually inflated instead of trusting the declared size,
+	// and never past it, so a lying header cannot force a large allocation;
+	// a reused buffer keeps its larger capacity
+	const zip_uint64_t initialSize = 1024 * 1024;
+	zip_uint64_t capacity = size < initialSize ? size : initialSize;
+	int extra = asText ? 1 : 0;
+	zip_uint64_t length = 0;
+	bool success = data.reserve((size_t)(capacity + extra));
+
+	while (success)
+	{
+		if (length == capacity)
+		{
+			if (capacity == size)
+			{
+				// more data than declared means a corrupt or crafted entry
+				char probe;
+				zip_int64_t result = zip_fread(zipFile, &probe, 1);
+				if (result != 0)
+				{
+					lastReadError = result > 0 ? READ_SIZE_MISMATCH : READ_FAILED;
+					success = false;
+				}
+				break;
+			}
+
+			capacity = capacity * 2 < size ? capacity * 2 : size;
+			data.setLength((size_t)length);
+			if (!data.reserve((size_t)(capacity + extra)))
+			{
+				success = false;
+				break;
+			}
+		}
+
+		// read at most initialSize at a time so the readahead can keep up
+		zip_uint64_t chunk = capacity - length < initialSize ? capacity - length : initialSize;
+		zip_int64_t result = zip_fread(zipFile, data.getData() + (size_t)length, chunk);
+		if (result <= 0)
+		{
+			if (result < 0)
+				success = false;
+			break;
+		}
+		length += result;
+
+		if (readahead != NULL)
+			readahead->progress(length, size);
+	}
+
+	zip_fclose(zipFile);
+
+	if (success && length != size)
+	{
+		lastReadError = READ_SIZE_MISMATCH;
+		success = false;
+	}
+
+	if (!success)
+	{
+		data.setLength(0);
+		return false;
+	}
+
+	//avoid buffer copy
+	if (asText)
+		data.getData()[(size_t)length] = '\0';
+
+	data.setLength((size_t)length);
+	lastReadError = READ_OK;
+	return true;
+}
+
+void *CZipArchive::readEntry(const string &zipEntry, bool asText, State state) const
+{
+	return readEntry(getEntry(zipEntry), asText, state);
+}
+
+std::string CZipArchive::readString(const std::string &zipEntry, State state /*= CURRENT*/) const
+{
+	CZipEntry entry = getEntry(zipEntry);
+	if (cache != NULL)
+	{
+		// build the string straight from the cached buffer
+		CZipEntryCache::Buffer content = readBuffer(entry, state);
+		if (!content)
+			return string();
+		return string(content->begin(), content->end());
+	}
+
+	// a temporary, so it never comes from a caller's arena
+	CZipBuffer content;
+	if (!readEntry(entry, content, false, state) || content.isEmpty())
+		return string();
+
+	return string(content.getData(), content.getLength());
+}
+
+CZipEntryCache::Buffer CZipArchive::readBuffer(const CZipEntry &zipEntry, State state /*= CURRENT*/) const
+{
+	lastReadError = READ_FAILED;
+
+	if (zipEntry.isNull() || !isOpen() || zipEntry.zipFile != this)
+		return CZipEntryCache::Buffer();
+
+	if (cache != NULL)
+		return readCached(zipEntry.getIndex(), zipEntry.getSize(), state);
+
+	vector<char> data;
+	if (!loadIndex(zipEntry.getIndex(), zipEntry.getSize(), state, data))
+		return CZipEntryCache::Buffer();
+
+	shared_ptr<vector<char> > content = make_shared<vector<char> >();
+	content->swap(data);
+	return content;
+}
+
+CZipEntryCache::Buffer CZipArchive::readBuffer(const std::string &zipEntry, State state /*= CURRENT*/) const
+{
+	return readBuffer(getEntry(zipEntry), state);
+}
+
+CZipEntryCache::Buffer CZipArchive::readCached(zip_uint64_t index, zip_uint64_t size, State state) const
+{
+	// original content never changes while the archive is open
+	zip_uint64_t key = state == ORIGINAL ? 0 : generation;
+	CZipEntryCache::Buffer content = cache->find(serial, key, index);
+	if (content)
+	{
+		lastReadError = READ_OK;
+		return content;
+	}
+
+	vector<char> data;
+	if (!loadIndex(index, size, state, data))
+		return CZipEntryCache::Buffer();
+
+	return cache->insert(serial, key, index, data);
+}
+
+bool CZipArchive::loadIndex(zip_uint64_t index, zip_uint64_t size, State state, vector<char> &data) const
+{
+	VectorBuffer buffer(data);
+	return readLimited(index, size, false, state, buffer);
+}
+
+void CZipArchive::setCache(CZipEntryCache *cache)
+{
+	if (this->cache != NULL && isOpen())
+		this->cache->erase(serial);
+
+	this->cache = cache;
+}
+
+zip_int64_t CZipArchive::readEntryRange(const CZipEntry &zipEntry, zip_uint64_t offset, void *data, size_t length, State state /*= CURRENT*/) const
+{
+	if (zipEntry.isNull() || !isOpen() || zipEntry.zipFile != this)
+		return -1;
+
+	if (offset >= zipEntry.getSize() || length == 0)
+		return 0;
+
+	if (length > zipEntry.getSize() - offset)
+		length = (size_t)(zipEntry.getSize() - offset);
+
+	if (!isRawEntry(zipEntry))
+		return readRangeSequential(zipEntry.getIndex(), offset, data, length, state);
+
+	zip_int64_t dataOffset = rawDirectory->getDataOffset(*rawInput, (size_t)zipEntry.getIndex());
+	if (dataOffset < 0)
+		return -1;
+
+	if (zipEntry.getMethod() == ZIP_METHOD_STORE)
+	{
+		if (!rawInput->readAt(dataOffset + offset, data, length))
+			return -1;
+		return (zip_int64_t)length;
+	}
+
+	// an entry whose index could not be built is not inflated twice on every read
+	if (getEntryIndex(zipEntry) == NULL && (failedIndexes.count(zipEntry.getIndex()) != 0 || !buildEntryIndex(zipEntry)))
+		return readRangeSequential(zipEntry.getIndex(), offset, data, length, state);
+
+	return entryIndexes[zipEntry.getIndex()].read(*rawInput, dataOffset, offset, data, length);
+}
+
+bool CZipArchive::buildEntryIndex(const CZipEntry &zipEntry, zip_uint64_t span /*= 4 * 1024 * 1024*/) const
+{
+	if (zipEntry.isNull() || !isOpen() || zipEntry.zipFile != this)
+		return false;
+
+	if (zipEntry.getMethod() != ZIP_METHOD_DEFLATE || !isRawEntry(zipEntry))
+		return false;
+
+	zip_int64_t dataOffset = rawDirectory->getDataOffset(*rawInput, (size_t)zipEntry.getIndex());
+	if (dataOffset < 0)
+		return false;
+
+	const CZipDirectoryEntry &entry = rawDirectory->getEntry((size_t)zipEntry.getIndex());
+	CZipEntryIndex index;
+	if (!index.build(*rawInput, dataOffset, entry.sizeComp, entry.size, entry.crc, span))
+	{
+		failedIndexes.insert(zipEntry.getIndex());
+		return false;
+	}
+
+	failedIndexes.erase(zipEntry.getIndex());
+	entryIndexes[zipEntry.getIndex()] = index;
+	return true;
+}
+
+const CZipEntryIndex *CZipArchive::getEntryIndex(const CZipEntry &zipEntry) const
+{
+	if (zipEntry.isNull() || zipEntry.zipFile != this)
+		return NULL;
+
+	map<zip_uint64_t, CZipEntryIndex>::const_iterator it = entryIndexes.find(zipEntry.getIndex());
+	if (it == entryIndexes.end())
+		return NULL;
+	return &it->second;
+}
+
+bool CZipArchive::setEntryIndex(const CZipEntry &zipEntry, const CZipEntryIndex &index) const
+{
+	if (zipEntry.isNull() || !isOpen() || zipEntry.zipFile != this || index.isEmpty())
+		return false;
+
+	if (zipEntry.getMethod() != ZIP_METHOD_DEFLATE || !isRawEntry(zipEntry))
+		return false;
+
+	// a saved index only fits the exact same compressed data
+	const CZipDirectoryEntry &entry = rawDirectory->getEntry((size_t)zipEntry.getIndex());
+	if (index.getSize() != entry.size || index.getInflatedSize() != entry.sizeComp || index.getCRC() != entry.crc)
+		return false;
+
+	failedIndexes.erase(zipEntry.getIndex());
+	entryIndexes[zipEntry.getIndex()] = index;
+	return true;
+}
+
+bool CZipArchive::openRaw(void) const
+{
+	if (rawDirectory != NULL)
+		return true;
+
+	// the archive does not change on disk while it is open, a failure stays a failure
+	if (rawFailed)
+		return false;
+
+	if (buffer != NULL)
+	{
+		if (buffer->empty())
+		{
+			rawFailed = true;
+			return false;
+		}
+		rawInput = new CZipBufferRandomInput(&(*buffer)[0], buffer->size());
+	}
+	else
+	{
+		rawFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+		if (rawFile == INVALID_HANDLE_VALUE)
+		{
+			rawFailed = true;
+			return false;
+		}
+		rawInput = new CZipHandleRandomInput(rawFile);
+	}
+
+	// the directory on disk must be the one libzip indexed
+	CZipDirectory *directory = new CZipDirectory;
+	if (!directory->read(*rawInput) || (zip_int64_t)directory->getCount() != getNbEntries(ORIGINAL))
+	{
+		delete directory;
+		closeRaw();
+		rawFailed = true;
+		return false;
+	}
+
+	rawDirectory = directory;
+	return true;
+}
+
+void CZipArchive::closeRaw(void) const
+{
+	delete rawDirectory;
+	rawDirectory = NULL;
+
+	delete rawInput;
+	rawInput = NULL;
+
+	if (rawFile != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(rawFile);
+		rawFile = INVALID_HANDLE_VALUE;
+	}
+
+	rawFailed = false;
+	entryIndexes.clear();
+	failedIndexes.clear();
 }
 
-bool CZipArchive::setEntryComment(const CZipEntry &entry, const string &comment) const
+bool CZipArchive::isRawEntry(const CZipEntry &zipEntry) const
 {
-	if (!isOpen())
+	if (!openRaw() || zipEntry.getIndex() >= rawDirectory->getCount())
 		return false;
 
-	if (entry.zipFile != this)
+	const CZipDirectoryEntry &entry = rawDirectory->getEntry((size_t)zipEntry.getIndex());
+	if ((entry.flags & ZIP_FLAG_ENCRYPTED) != 0)
 		return false;
-	
-	string realComment = AsciiToUtf8(comment);
-	int result = zip_file_set_comment(zipHandle, entry.getIndex(), realComment.c_str(), realComment.size(), DEFAULLT_ENC_FLAG);
-	return result == 0;
+
+	if (entry.method != ZIP_METHOD_STORE && entry.method != ZIP_METHOD_DEFLATE)
+		return false;
+
+	// data replaced since open no longer matches the directory
+	return entry.size == zipEntry.getSize() && entry.sizeComp == zipEntry.getInflatedSize() &&
+		entry.crc == (zip_uint32_t)zipEntry.getCRC() && entry.method == zipEntry.getMethod();
 }
 
-void *CZipArchive::readEntry(const CZipEntry &zipEntry, bool asText, State state) const
+zip_int64_t CZipArchive::readRangeSequential(zip_uint64_t index, zip_uint64_t offset, void *data, size_t length, State state) const
 {
-	if (zipEntry.isNull())
-		return NULL;
+	int flag = state == ORIGINAL ? ZIP_FL_UNCHANGED : 0;
+	struct zip_file *zipFile = zip_fopen_index(zipHandle, index, flag);
+	if (!zipFile)
+		return -1;
 
-	if (!isOpen())
-		return NULL;
+	if (offset > 0 && zip_fseek(zipFile, (zip_int64_t)offset, SEEK_SET) != 0)
+	{
+		// the file is unusable after a failed seek, inflate up to offset instead
+		zip_fclose(zipFile);
+		zipFile = zip_fopen_index(zipHandle, index, flag);
+		if (!zipFile)
+			return -1;
 
-	if (zipEntry.zipFile != this)
-		return NULL;
+		char skip[4096];
+		zip_uint64_t remaining = offset;
+		while (remaining > 0)
+		{
+			zip_uint64_t count = remaining < sizeof(skip) ? remaining : sizeof(skip);
+			zip_int64_t readCount = zip_fread(zipFile, skip, count);
+			if (readCount <= 0)
+			{
+				zip_fclose(zipFile);
+				return readCount < 0 ? -1 : 0;
+			}
+			remaining -= readCount;
+		}
+	}
 
-	int flag = state == ORIGINAL ? ZIP_FL_UNCHANGED : 0;
-	struct zip_file *zipFile = zip_fopen_index(zipHandle, zipEntry.getIndex(), flag);
-	if (zipFile)
+	char *bytes = (char *)data;
+	size_t produced = 0;
+	while (produced < length)
 	{
-		zip_uint64_t size = zipEntry.getSize();
-		zip_int64_t isize = (zip_int64_t)size; //there will be a warning here, but unavoidable...
-#pragma warning(suppress:4244)
-		char *data = new char[isize + (asText ? 1 : 0)];
-		if (!data)  //allocation error
+		zip_int64_t readCount = zip_fread(zipFile, bytes + produced, length - produced);
+		if (readCount < 0)
 		{
 			zip_fclose(zipFile);
-			return NULL;
+			return -1;
 		}
-
-		zip_int64_t result = zip_fread(zipFile, data, size);
-		zip_fclose(zipFile);
-
-		//avoid buffer copy
-		if (asText)
-			data[isize] = '\0';
-
-		if (result == isize)
-			return data;
-		else     //unexpected number of bytes read => crash ?
-			delete[] data;
+		if (readCount == 0)
+			break;
+		produced += (size_t)readCount;
 	}
 
-	return NULL;
+	zip_fclose(zipFile);
+	return (zip_int64_t)produced;
 }
 
-void *CZipArchive::readEntry(const string &zipEntry, bool asText, State state) const
+bool CZipArchive::writeEntry(const CZipEntry &zipEntry, const string &fileName, State state /*= CURRENT*/) const
 {
-	return readEntry(getEntry(zipEntry), asText, state);
-}
+	if (zipEntry.isNull())
+		return false;
 
-std::string CZipArchive::readString(const std::string &zipEntry, State state /*= CURRENT*/) const
-{
-	CZipEntry entry = getEntry(zipEntry);
-	char *content = (char *)readEntry(entry, true, state);
-	if (content == NULL)
-		return string();
+	if (!isOpen())
+		return false;
+
+	if (zipEntry.zipFile != this)
+		return false;
+
+	// an asynchronous output reports the result once the file is written
+	bool result = writeIndex(zipEntry.getIndex(), zipEntry.getDate(), fileName, state);
+	if (fileOutput != NULL && fileOutput->finish() > 0)
+		return false;
 
-#pragma warning(suppress:4244)
-	string str(content, entry.getSize());
-	delete[] content;
-	return str;
+	return result;
 }
 
-bool CZipArchive::writeEntry(const CZipEntry &zipEntry, const string &fileName, State state /*= CURRENT*/) const
+bool CZipArchive::writeEntry(const CZipEntry &zipEntry, const string &fileName, CZipHashManifest &manifest, State state /*= CURRENT*/) const
 {
 	if (zipEntry.isNull())
 		return false;
@@ -312,39 +1072,104 @@ bool CZipArchive::writeEntry(const CZipEntry &zipEntry, const string &fileName,
 	if (zipEntry.zipFile != this)
 		return false;
 
+	// the record of a file the asynchronous output failed to write is dropped again
+	bool result = writeIndex(zipEntry.getIndex(), zipEntry.getDate(), fileName, state, &manifest);
+	vector<string> failedFiles;
+	if (fileOutput != NULL && fileOutput->finish(&failedFiles) > 0)
+	{
+		manifest.discard(failedFiles);
+		return false;
+	}
+
+	return result;
+}
+
+bool CZipArchive::writeIndex(zip_uint64_t index, time_t time, const string &fileName, State state, CZipHashManifest *manifest /*= NULL*/,
+	CZipReadahead *readahead /*= NULL*/) const
+{
 	int flag = state == ORIGINAL ? ZIP_FL_UNCHANGED : 0;
-	struct zip_file *zipFile = zip_fopen_index(zipHandle, zipEntry.getIndex(), flag);
+	struct zip_stat stat;
+	zip_stat_init(&stat);
+	if (zip_stat_index(zipHandle, index, flag, &stat) != 0)
+	{
+		lastReadError = READ_FAILED;
+		return false;
+	}
+
+	lastReadError = checkLimits(index, stat.size, state, false);
+	if (lastReadError != READ_OK)
+		return false;
+
+	lastReadError = READ_FAILED;
+	struct zip_file *zipFile = zip_fopen_index(zipHandle, index, flag);
 	if (!zipFile)
 		return false;
 
-	zip_uint64_t size = zipEntry.getSize();
-	zip_int64_t isize = (zip_int64_t)size; //there will be a warning here, but unavoidable...
-	
-	// ļ
-	HANDLE hFile = CreateFileA(fileName.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL);
-	if (hFile == INVALID_HANDLE_VALUE)
+	// 创建文件
+	CZipSyncFileOutput syncOutput;
+	CZipFileOutput &output = fileOutput != NULL ? *fileOutput : syncOutput;
+	CZipOutputStream *file = output.createFile(fileName);
+	if (file == NULL)
+	{
+		zip_fclose(zipFile);
+		return false;
+	}
+
+	if (manifest != NULL && !manifest->begin())
 	{
+		output.closeFile(file, time, false);
 		zip_fclose(zipFile);
 		return false;
 	}
 	
-	// ȡ
+	// 读取内容
 	char data[4096];
 	zip_int64_t readCount;
+	zip_uint64_t written = 0;
 	while ((readCount = zip_fread(zipFile, data, sizeof(data))) > 0)
 	{
-		DWORD dwWritten = 0;
-		WriteFile(hFile, data, (DWORD)readCount, &dwWritten, NULL);
+		// stop an entry that inflates past its declared size
+		written += readCount;
+		if (written > stat.size)
+		{
+			if (manifest != NULL)
+				manifest->cancel();
+			output.closeFile(file, time, false);
+			zip_fclose(zipFile);
+			lastReadError = READ_SIZE_MISMATCH;
+			return false;
+		}
+
+		file->write(data, (size_t)readCount);
+
+		// the digest is computed by the hash thread while the next block is inflated
+		if (manifest != NULL)
+			manifest->update(data, (size_t)readCount);
+
+		// a large entry is prefetched window by window as it is read
+		if (readahead != NULL)
+			readahead->progress(written, stat.size);
+	}
+
+	// a read error or a short entry leaves a truncated file behind
+	if (readCount < 0 || written != stat.size)
+	{
+		if (manifest != NULL)
+			manifest->cancel();
+		output.closeFile(file, time, false);
+		zip_fclose(zipFile);
+		lastReadError = readCount < 0 ? READ_FAILED : READ_SIZE_MISMATCH;
+		return false;
 	}
-	
-	// ļʱ
-	FILETIME ftUTC;
-	TimetToFileTime(zipEntry.getDate(), &ftUTC);
-	SetFileTime(hFile, &ftUTC, &ftUTC, &ftUTC);
 
-	CloseHandle(hFile);
+	bool hashed = manifest == NULL || manifest->finish(Utf8ToAscii(string(stat.name)), fileName, written, stat.crc);
 	zip_fclose(zipFile);
+	
+	// 设置文件时间并关闭
+	if (!output.closeFile(file, time, true) || !hashed)
+		return false;
 
+	lastReadError = READ_OK;
 	return true;
 }
 
@@ -364,6 +1189,8 @@ int CZipArchive::deleteEntry(const CZipEntry &entry) const
 	if (mode == READ_ONLY)
 		return -1;    //deletion not allowed
 
+	++generation;    //invalidates cached CURRENT content
+
 	if (entry.isFile())
 	{
 		int result = zip_delete(zipHandle, entry.getIndex());
@@ -414,6 +1241,9 @@ int CZipArchive::renameEntry(const CZipEntry &entry, const string &newName) cons
 	if (mode == READ_ONLY)
 		return -1;
 
+	++generation;
+	onlyDeletes = false;
+
 	if (newName.length() == 0)
 		return 0;
 
@@ -521,6 +1351,9 @@ bool CZipArchive::addFile(const string &entryName, const string &file) const
 	if (IS_DIRECTORY(entryName))
 		return false;
 
+	++generation;
+	onlyDeletes = false;
+
 	int lastSlash = entryName.rfind(DIRECTORY_SEPARATOR);
 	if (lastSlash != -1) //creates the needed parent directories
 	{
@@ -530,16 +1363,7 @@ bool CZipArchive::addFile(const string &entryName, const string &file) const
 			return false;
 	}
 
-	FILE *fileSteam;
-	zip_int64_t fileSize = -1;
-	if (fopen_s(&fileSteam, file.c_str(), "rb+") == 0)
-	{
-		_fseeki64(fileSteam, 0, SEEK_END);
-		fileSize =  _ftelli64(fileSteam);
-		fclose(fileSteam);
-	}
-
-	zip_source *source = zip_source_file(zipHandle, file.c_str(), 0, fileSize);
+	zip_source *source = createFileSource(file);
 	if (source != NULL)
 	{
 		zip_int64_t result = zip_file_add(zipHandle, AsciiToUtf8(entryName).c_str(), source, ZIP_FL_OVERWRITE);
@@ -552,6 +1376,20 @@ bool CZipArchive::addFile(const string &entryName, const string &file) const
 	return false;
 }
 
+zip_source *CZipArchive::createFileSource(const string &file) const
+{
+	FILE *fileSteam;
+	zip_int64_t fileSize = -1;
+	if (fopen_s(&fileSteam, file.c_str(), "rb+") == 0)
+	{
+		_fseeki64(fileSteam, 0, SEEK_END);
+		fileSize =  _ftelli64(fileSteam);
+		fclose(fileSteam);
+	}
+
+	return zip_source_file(zipHandle, file.c_str(), 0, fileSize);
+}
+
 bool CZipArchive::addData(const string &entryName, const void *data, unsigned int length, bool freeData) const
 {
 	if (!isOpen())
@@ -563,6 +1401,9 @@ bool CZipArchive::addData(const string &entryName, const void *data, unsigned in
 	if (IS_DIRECTORY(entryName))
 		return false;
 
+	++generation;
+	onlyDeletes = false;
+
 	int lastSlash = entryName.rfind(DIRECTORY_SEPARATOR);
 	if (lastSlash != -1) //creates the needed parent directories
 	{
@@ -602,6 +1443,7 @@ bool CZipArchive::addEntry(const string &entryName) const
 		string pathToCreate = entryName.substr(0, nextSlash + 1);
 		if (!hasEntry(pathToCreate))
 		{
+			onlyDeletes = false;
 			zip_int64_t result = zip_dir_add(zipHandle, AsciiToUtf8(pathToCreate).c_str(), DEFAULLT_ENC_FLAG);
 			if (result == -1)
 				return false;
@@ -614,59 +1456,358 @@ bool CZipArchive::addEntry(const string &entryName) const
 
 void CZipArchive::extract(const std::string &folderName)
 {
-	vector<CZipEntry> entries = getEntries(CURRENT);
-	vector<CZipEntry>::iterator iterEntry = entries.begin(), iterEnd = entries.end();
+	extract(folderName, CZipEntryFilter());
+}
+
+int CZipArchive::extract(const std::string &folderName, const CZipEntryFilter &filter, const std::string &stripPrefix,
+	CZipHashManifest *manifest /*= NULL*/)
+{
+	if (!isOpen())
+		return -1;
+
+	vector<zip_uint64_t> indices;
+	selectEntries(filter, indices, CURRENT);
+
+	CZipReadahead readahead;
+	const CZipDirectory *directory = orderEntries(indices, readahead);
+
+	CZipSyncFileOutput syncOutput;
+	CZipFileOutput &output = fileOutput != NULL ? *fileOutput : syncOutput;
+
+	int counter = 0;
 	string extractPath;
-	for (; iterEntry != iterEnd; iterEntry++)
+	string entryName;
+	string lastFolder;
+	vector<zip_uint64_t>::const_iterator it;
+	for (it = indices.begin(); it != indices.end(); ++it)
 	{
-		if (iterEntry->isFile())
+		CZipEntry entry = getEntry((zip_int64_t)*it);
+		if (entry.isNull() || entry.isDirectory())
+			continue;
+
+		entryName = entry.getName();
+		if (!stripPrefix.empty())
+		{
+			if (entryName.size() <= stripPrefix.size() || entryName.compare(0, stripPrefix.size(), stripPrefix) != 0)
+				continue;
+			entryName.erase(0, stripPrefix.size());
+		}
+
+		extractPath = concatPath(folderName, entryName);
+		string folder = getFolderPath(extractPath);
+		if (folder != lastFolder)
+		{
+			output.createFolder(folder);
+			lastFolder = folder;
+		}
+
+		adviseEntry(*it, directory, readahead);
+		if (writeIndex(entry.getIndex(), entry.getDate(), extractPath, CURRENT, manifest, &readahead))
+			++counter;
+	}
+
+	// files still being written by an asynchronous output
+	vector<string> failedFiles;
+	counter -= (int)output.finish(manifest != NULL ? &failedFiles : NULL);
+	if (manifest != NULL)
+		manifest->discard(failedFiles);
+	return counter;
+}
+
+int CZipArchive::readEntries(const CZipEntryFilter &filter, ReadCallback callback, void *userData, State state) const
+{
+	if (!isOpen())
+		return -1;
+
+	vector<zip_uint64_t> indices;
+	selectEntries(filter, indices, state);
+
+	CZipReadahead readahead;
+	const CZipDirectory *directory = orderEntries(indices, readahead);
+
+	// one buffer reused for every entry, it only grows to the largest one
+	int counter = 0;
+	ReadError firstError = READ_OK;
+	CZipBuffer data(getMemoryResource());
+	vector<zip_uint64_t>::const_iterator it;
+	for (it = indices.begin(); it != indices.end(); ++it)
+	{
+		CZipEntry entry = getEntry((zip_int64_t)*it, state);
+		if (entry.isNull() || entry.isDirectory())
+			continue;
+
+		// an entry over the limits or unreadable does not end the whole batch
+		adviseEntry(*it, directory, readahead);
+		if (!readLimited(*it, entry.getSize(), false, state, data, &readahead))
 		{
-			extractPath = concatPath(folderName, iterEntry->getName());
-			createFolder(getFolderPath(extractPath));
-			writeEntry(*iterEntry, extractPath);
+			if (firstError == READ_OK)
+				firstError = lastReadError;
+			continue;
 		}
+
+		++counter;
+		if (!callback(entry, data.isEmpty() ? NULL : data.getData(), data.getLength(), userData))
+			break;
+	}
+
+	lastReadError = firstError;
+	return counter;
+}
+
+bool CZipArchive::readDirectory(CZipDirectory &directory) const
+{
+	if (buffer != NULL)
+	{
+		if (buffer->empty())
+			return false;
+
+		CZipBufferRandomInput input(&(*buffer)[0], buffer->size());
+		return directory.read(input);
+	}
+
+	HANDLE hFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	CZipHandleRandomInput input(hFile);
+	bool result = directory.read(input);
+	CloseHandle(hFile);
+	return result;
+}
+
+const CZipDirectory *CZipArchive::orderEntries(vector<zip_uint64_t> &indices, CZipReadahead &readahead) const
+{
+	// the directory parsed for range reads is kept for the whole open, and already matches libzip's index
+	if (indices.size() < 2 || !openRaw())
+		return NULL;
+
+	stable_sort(indices.begin(), indices.end(), OffsetLess(*rawDirectory));
+
+	// memory archives need no readahead
+	if (buffer == NULL)
+		readahead.open(path);
+	return rawDirectory;
+}
+
+void CZipArchive::adviseEntry(zip_uint64_t index, const CZipDirectory *directory, CZipReadahead &readahead)
+{
+	if (directory == NULL || !readahead.isOpen() || index >= directory->getCount())
+		return;
+
+	const CZipDirectoryEntry &entry = directory->getEntry((size_t)index);
+	readahead.advise(entry.offset, ZIP_LOCAL_HEADER_SIZE + entry.rawName.size() + entry.sizeComp);
+}
+
+bool CZipArchive::addFolder(const string &entryName, const string &folderName, const FolderOptions &options /*= FolderOptions()*/)
+{
+	if (!isOpen())
+		return false;
+
+	if (mode == READ_ONLY)
+		return false;    //adding not allowed
+
+	vector<CZipFolderScanner::File> files;
+	CZipFolderScanner scanner(options.scanThreads);
+	if (!scanner.scan(entryName, folderName, files))
+		return false;
+
+	if (files.empty())
+		return true;
+
+	vector<zip_int64_t> shared;
+	if (options.deduplicate && !compressShared(files, shared))
+		return false;
+
+	++generation;
+	onlyDeletes = false;
+
+	set<string> directories;
+	size_t batch = options.maxOpenFiles > 0 ? options.maxOpenFiles : 1;
+	for (size_t first = 0; first < files.size(); first += batch)
+	{
+		size_t last = files.size() - first > batch ? first + batch : files.size();
+		if (!addFolderBatch(files, first, last, shared, options, directories))
+			return false;
 	}
+
+	return true;
 }
 
-bool CZipArchive::addFolder(const string &entryName, const string &folderName)
+bool CZipArchive::compressShared(const vector<CZipFolderScanner::File> &files, vector<zip_int64_t> &shared)
 {
-	WIN32_FIND_DATAA fd = {0};
-	string strFind = concatPath(folderName, "*.*");
-	HANDLE hFind = FindFirstFileA(strFind.c_str(), &fd);
-	if (hFind == INVALID_HANDLE_VALUE)
+	vector<size_t> original;
+	CZipDuplicateFinder finder;
+	if (finder.find(files, original) == 0)
+		return true;
+
+	char tempPath[MAX_PATH];
+	char tempFile[MAX_PATH];
+	if (GetTempPathA(MAX_PATH, tempPath) == 0 || GetTempFileNameA(tempPath, "zip", 0, tempFile) == 0)
+		return false;
+
+	CZipArchive *helper = new CZipArchive(tempFile);
+	if (!helper->open(NEW))
+	{
+		delete helper;
+		DeleteFileA(tempFile);
 		return false;
+	}
 
-	string fileName;
-	string fileEntryName;
-	do
+	// the first copy of every duplicated content, named after its file index
+	shared.assign(files.size(), -1);
+	bool result = true;
+	for (size_t i = 0; i < files.size() && result; ++i)
 	{
-		if(strcmp(fd.cFileName, ".") == 0 || strcmp(fd.cFileName, "..") == 0)
+		size_t first = original[i];
+		if (first == i)
 			continue;
 
-		fileName = concatPath(folderName, fd.cFileName);
-		fileEntryName = concatPath(entryName, fd.cFileName, '/');
-		if ((fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0)
+		if (shared[first] < 0)
 		{
-			fileEntryName.push_back('/');
-			if (!addFolder(fileEntryName, fileName))
+			char name[32];
+			sprintf_s(name, sizeof(name), "%u", (unsigned int)first);
+			zip_source *source = zip_source_file(helper->zipHandle, files[first].fileName.c_str(), 0, -1);
+			if (source != NULL)
 			{
-				FindClose(hFind);
-				return FALSE;
+				shared[first] = zip_file_add(helper->zipHandle, name, source, 0);
+				if (shared[first] < 0)
+					zip_source_free(source);
 			}
+			result = shared[first] >= 0;
+		}
+		shared[i] = shared[first];
+	}
+
+	if (!result)
+		helper->discard();
+
+	// compressing happens here, once per content
+	if (!result || !helper->close() || !helper->open(READ_ONLY))
+	{
+		delete helper;
+		DeleteFileA(tempFile);
+		return false;
+	}
+
+	sharedArchives.push_back(helper);
+	return true;
+}
+
+void CZipArchive::closeShared(void)
+{
+	vector<CZipArchive *>::iterator it;
+	for (it = sharedArchives.begin(); it != sharedArchives.end(); ++it)
+	{
+		CZipArchive *helper = *it;
+		helper->close();
+		DeleteFileA(helper->getPath().c_str());
+		delete helper;
+	}
+	sharedArchives.clear();
+}
+
+bool CZipArchive::addFolderBatch(const vector<CZipFolderScanner::File> &files, size_t first, size_t last, const vector<zip_int64_t> &shared,
+	const FolderOptions &options, set<string> &directories)
+{
+	struct PendingRead
+	{
+		HANDLE hFile;
+		OVERLAPPED overlapped;
+		void *data;
+		bool done;
+	};
+
+	// start reading every small file of the batch at once
+	size_t count = last - first;
+	vector<PendingRead> reads(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		const CZipFolderScanner::File &file = files[first + i];
+		PendingRead &read = reads[i];
+		read.hFile = INVALID_HANDLE_VALUE;
+		read.data = NULL;
+		read.done = false;
+		memset(&read.overlapped, 0, sizeof(read.overlapped));
+
+		if (!shared.empty() && shared[first + i] >= 0)
+			continue;
+
+		if (file.size == 0 || file.size > options.smallFileSize || file.size > ZIP_INT32_MAX ||
+			arena.getSize() + file.size > options.maxMemory)
+			continue;
+
+		read.hFile = CreateFileA(file.fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+			FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (read.hFile == INVALID_HANDLE_VALUE)
+			continue;
+
+		read.data = arena.allocate((size_t)file.size);
+		if (read.data == NULL ||
+			(!ReadFile(read.hFile, read.data, (DWORD)file.size, NULL, &read.overlapped) && GetLastError() != ERROR_IO_PENDING))
+		{
+			CloseHandle(read.hFile);
+			read.hFile = INVALID_HANDLE_VALUE;
 		}
+	}
+
+	// a short read means the file changed since it was listed, libzip reads it again at close
+	for (size_t i = 0; i < count; ++i)
+	{
+		PendingRead &read = reads[i];
+		if (read.hFile == INVALID_HANDLE_VALUE)
+			continue;
+
+		DWORD dwRead = 0;
+		read.done = GetOverlappedResult(read.hFile, &read.overlapped, &dwRead, TRUE) && dwRead == files[first + i].size;
+		CloseHandle(read.hFile);
+	}
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		const CZipFolderScanner::File &file = files[first + i];
+		zip_source *source;
+		if (!shared.empty() && shared[first + i] >= 0)
+			source = zip_source_zip(zipHandle, sharedArchives.back()->zipHandle, shared[first + i], ZIP_FL_COMPRESSED, 0, -1);
+		else if (reads[i].done)
+			source = zip_source_buffer(zipHandle, reads[i].data, file.size, 0);
 		else
+			source = zip_source_file(zipHandle, file.fileName.c_str(), 0, -1);
+
+		// the buffer source keeps the file time, as zip_source_file would
+		if (source == NULL || !addFolderEntry(file.entryName, source, FileTimeToTimet(file.time), directories))
+			return false;
+	}
+
+	return true;
+}
+
+bool CZipArchive::addFolderEntry(const string &entryName, zip_source *source, time_t time, set<string> &directories)
+{
+	// each parent directory is looked up in the archive only once
+	int nextSlash = entryName.find(DIRECTORY_SEPARATOR);
+	while (nextSlash != -1)
+	{
+		string pathToCreate = entryName.substr(0, nextSlash + 1);
+		if (directories.insert(pathToCreate).second && !hasEntry(pathToCreate))
 		{
-			if (!addFile(fileEntryName, fileName))
+			zip_int64_t result = zip_dir_add(zipHandle, AsciiToUtf8(pathToCreate).c_str(), DEFAULLT_ENC_FLAG);
+			if (result == -1)
 			{
-				FindClose(hFind);
+				zip_source_free(source);
 				return false;
 			}
 		}
+		nextSlash = entryName.find(DIRECTORY_SEPARATOR, nextSlash + 1);
+	}
 
+	zip_int64_t index = zip_file_add(zipHandle, AsciiToUtf8(entryName).c_str(), source, ZIP_FL_OVERWRITE);
+	if (index < 0)
+	{
+		zip_source_free(source);    //unable to add the file
+		return false;
 	}
-	while (FindNextFileA(hFind, &fd));
 
-	FindClose(hFind);
+	zip_file_set_mtime(zipHandle, index, time, 0);
 	return true;
 }
 
@@ -728,9 +1869,15 @@ void CZipArchive::createFolder(const std::string &folderName)
 	}
 }
 
-void CZipArchive::TimetToFileTime(time_t t, LPFILETIME pft) const
+void CZipArchive::TimetToFileTime(time_t t, LPFILETIME pft)
 {
 	LONGLONG ll = Int32x32To64(t, 10000000) + 116444736000000000;
 	pft->dwLowDateTime = (DWORD) ll;
 	pft->dwHighDateTime = ll >>32;
+}
+
+time_t CZipArchive::FileTimeToTimet(const FILETIME &ft)
+{
+	LONGLONG ll = ((LONGLONG)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+	return (time_t)((ll - 116444736000000000) / 10000000);
 }
\ No newline at end of file
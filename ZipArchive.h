@@ -2,93 +2,164 @@
 #define	ZIPARCHIVE_H
 
 #include <cstdio>
+#include <map>
+#include <set>
 #include <string>
 #include <vector>
 #include <Windows.h>
 
 #include <zipconf.h>
 #include "UnicodeConv.h"
+#include "ZipEntryFilter.h"
+#include "ZipArena.h"
+#include "ZipMemory.h"
+#include "ZipEntryCache.h"
+#include "ZipEntryIndex.h"
+#include "ZipFolderScanner.h"
+#include "ZipHasher.h"
 
 struct zip;
+struct zip_source;
 
 #define DIRECTORY_SEPARATOR '/'
 #define IS_DIRECTORY(str) (str.length()>0 && str[str.length()-1]==DIRECTORY_SEPARATOR)
 
 class CZipEntry;
+class CZipDirectory;
+class CZipFileOutput;
+class CZipEntryOrder;
+class CZipReadahead;
+class CZipRandomInput;
 
 class CZipArchive
 {
+	friend class CZipReadPool;
+	friend class CZipBatch;
+
 public:
 
 	/*
-	 * WRITE ӵzip  zip
-	 * NEW zip  ɾzip
+	 * WRITE 添加到已有zip 或 创建新zip
+	 * NEW 创建新zip 或 删除已有zip的所有数据
 	 */
 	enum OpenMode { NOT_OPEN, READ_ONLY, WRITE, NEW };
 
 	enum State { ORIGINAL, CURRENT };
 
+	// 最近一次读取条目的结果
+	enum ReadError
+	{
+		READ_OK,
+		READ_FAILED,            // 条目不存在或解压失败
+		READ_TOO_LARGE,         // 条目尺寸超过单个条目的内存上限
+		READ_RATIO_EXCEEDED,    // 压缩比超过限制
+		READ_SIZE_MISMATCH      // 解压后的尺寸与目录中的尺寸不一致
+	};
+
 	CZipArchive(const std::string &zipPath, bool isUtf8 = false, const std::string &password = "");
+
+	/*
+	 * 以内存缓冲区作为zip存档，不经过文件系统
+	 * 直接读取buffer中的数据，close时新存档与buffer交换(不复制)，
+	 * buffer须在存档关闭前保持有效
+	 */
+	CZipArchive(std::vector<char> &buffer, bool isUtf8 = false, const std::string &password = "");
 	virtual ~CZipArchive(void);
 
-	// zip浵
+	// 打开zip存档
 	bool open(OpenMode mode = READ_ONLY, bool checkConsistency = false);
 
-	// zip·
+	// 返回zip路径
 	std::string getPath(void) const
 	{
 		return path;
 	}
 
-	// شģʽ
+	// 是否为内存存档
+	bool isInMemory(void) const
+	{
+		return buffer != NULL;
+	}
+
+	// 返回打开模式
 	OpenMode getMode(void) const
 	{
 		return mode;
 	}
 
-	// رzip浵
-	void close(void);
+	// 关闭zip存档，写入失败时返回false(修改被丢弃)，压缩无法恢复或重排条目失败时也返回false
+	bool close(void);
 
-	// رzip浵ع
+	// 关闭zip存档，回滚操作
 	void discard(void);
 
-	// ɾ浵
+	/*
+	 * 打开后只删除了条目时，close在原文件中把保留的条目向前移动并截断文件，
+	 * 不再由libzip把所有保留的条目复制到临时文件，默认关闭
+	 * 有其他修改、内存存档或压缩失败时按原方式关闭，中断的压缩在下次open时完成
+	 * 压缩中断后无法恢复，或回退时无法重新打开存档时close返回false
+	 */
+	void setCompactOnClose(bool compact)
+	{
+		compactOnClose = compact;
+	}
+
+	bool getCompactOnClose(void) const
+	{
+		return compactOnClose;
+	}
+
+	/*
+	 * 设置close时条目在文件中的排列顺序，NULL为保持libzip写入的顺序，存档不负责释放order
+	 * 以写模式打开的存档在libzip写完后按顺序重写一次，重写失败时保留原来的顺序，close返回false
+	 */
+	void setEntryOrder(const CZipEntryOrder *order)
+	{
+		entryOrder = order;
+	}
+
+	const CZipEntryOrder *getEntryOrder(void) const
+	{
+		return entryOrder;
+	}
+
+	// 删除存档
 	bool unlink(void);
 
-	// zip浵Ƿ
+	// zip存档是否打开
 	bool isOpen(void) const
 	{
 		return zipHandle != NULL;
 	}
 
-	// zip浵Ƿ޸
+	// zip存档是否可以修改
 	bool isMutable(void) const
 	{
 		return isOpen() && mode != NOT_OPEN && mode != READ_ONLY;
 	}
 
-	// zip浵ǷҪ
+	// zip存档是否要加密
 	bool isEncrypted(void) const
 	{
 		return !password.empty();
 	}
 
-	// zip浵ע
+	// 定义zip存档的注释
 	std::string getComment(State state = CURRENT) const;
 	bool setComment(const std::string &comment) const;
 
-	// ɾzip浵ע
+	// 删除zip存档的注释
 	bool removeComment(void) const
 	{
 		return setComment(std::string());
 	}
 
 	/**
-	 * zip浵еĿ(ļ)
-	 * 3ĿɾһĿǻ᷵3,
-	 * һĿCURRENT״̬4ORIGINAL3
+	 * 返回zip存档中的条目数量(包含文件夹)
+	 * 如果有3个条目，你删除一个条目，还是会返回3,
+	 * 如果你添加一个条目，CURRENT状态将返回4，ORIGINAL将返回3。
 	 *
-	 * getEntriesԻȡzip浵ʵĿ
+	 * getEntries可以获取zip存档的真实条目
 	 */
 	zip_int64_t getNbEntries(State state = CURRENT) const;
 	zip_int64_t getEntriesCount(State state = CURRENT) const
@@ -96,79 +167,308 @@ public:
 		return getNbEntries(state);
 	}
 
-	// Ŀ
+	// 返回所有条目
 	std::vector<CZipEntry> getEntries(State state = CURRENT) const;
 
-	// жĿǷ
+	// 返回过滤器选中的条目，只为选中的条目创建CZipEntry
+	std::vector<CZipEntry> getEntries(const CZipEntryFilter &filter, State state = CURRENT) const;
+
+	// 判断条目是否存在
 	bool hasEntry(const std::string &name, bool excludeDirectories = false, bool caseSensitive = true, State state = CURRENT) const;
 
-	// ȡĿ
+	// 根据索引获取条目
 	CZipEntry getEntry(const std::string &name, bool excludeDirectories = false, bool caseSensitive = true, State state = CURRENT) const;
 	CZipEntry getEntry(zip_int64_t index, State state = CURRENT) const;
 
-	// Ŀע
+	// 定义条目的注释
 	std::string getEntryComment(const CZipEntry &entry, State state = CURRENT) const;
 	bool setEntryComment(const CZipEntry &entry, const std::string &comment) const;
 
-	// ȡĿ
+	// 读取条目内容
 	void *readEntry(const CZipEntry &zipEntry, bool asText = false, State state = CURRENT) const;
 	void *readEntry(const std::string &zipEntry, bool asText = false, State state = CURRENT) const;
 	std::string readString(const std::string &zipEntry, CZipArchive::State state = CZipArchive::CURRENT) const;
 
-	// Ŀд뵽ļ
+	/*
+	 * 把条目内容读入buffer，由buffer的内存来源分配，asText时在数据后加'\0'(不计入长度)
+	 * buffer原有的容量足够时直接复用，批量读取时可以反复使用同一个buffer
+	 */
+	bool readEntry(const CZipEntry &zipEntry, CZipBuffer &buffer, bool asText = false, State state = CURRENT) const;
+	bool readEntry(const std::string &zipEntry, CZipBuffer &buffer, bool asText = false, State state = CURRENT) const;
+
+	/*
+	 * 设置readEntries批量读取时缓冲区的内存来源，NULL为默认的new[]，存档不负责释放resource
+	 * readString、readBuffer和条目缓存不使用它，CZipBuffer使用构造时指定的内存来源
+	 */
+	void setMemoryResource(CZipMemoryResource *resource)
+	{
+		memoryResource = resource;
+	}
+
+	CZipMemoryResource *getMemoryResource(void) const
+	{
+		return memoryResource != NULL ? memoryResource : CZipMemoryResource::getDefault();
+	}
+
+	// 以只读共享缓冲区返回条目内容，设置了缓存时优先从缓存读取
+	CZipEntryCache::Buffer readBuffer(const CZipEntry &zipEntry, State state = CURRENT) const;
+	CZipEntryCache::Buffer readBuffer(const std::string &zipEntry, State state = CURRENT) const;
+
+	/*
+	 * 设置条目内容缓存，NULL为不使用缓存，存档不负责释放cache
+	 * 设置后readEntry/readString/readBuffer先查找缓存，
+	 * 添加、删除、重命名条目后CURRENT状态的缓存自动失效
+	 */
+	void setCache(CZipEntryCache *cache);
+	CZipEntryCache *getCache(void) const
+	{
+		return cache;
+	}
+
+	/*
+	 * 读取条目解压后[offset, offset + length)的内容，返回读取的字节数，出错时返回-1
+	 * 未修改的存储条目直接定位读取，deflate条目第一次读取时建立检查点索引，
+	 * 加密或已修改的条目从头解压到offset
+	 */
+	zip_int64_t readEntryRange(const CZipEntry &zipEntry, zip_uint64_t offset, void *data, size_t length, State state = CURRENT) const;
+
+	// 建立deflate条目的检查点索引，span为检查点间隔
+	bool buildEntryIndex(const CZipEntry &zipEntry, zip_uint64_t span = 4 * 1024 * 1024) const;
+
+	// 返回条目的检查点索引，没有时返回NULL，保存后可以用setEntryIndex加载
+	const CZipEntryIndex *getEntryIndex(const CZipEntry &zipEntry) const;
+	bool setEntryIndex(const CZipEntry &zipEntry, const CZipEntryIndex &index) const;
+
+	/*
+	 * 读取到内存时单个条目的字节上限，0为不限制
+	 * 超过上限的条目直接拒绝，应改用writeEntry或readEntryRange流式读取
+	 * 这是每个条目的上限，不是整个存档的内存预算：同时持有的多个条目不合并计算，
+	 * 峰值内存约为上限乘以调用者同时持有的条目数，条目缓存的内存由CZipEntryCache的字节预算限制
+	 */
+	void setMemoryLimit(zip_uint64_t limit)
+	{
+		memoryLimit = limit;
+	}
+
+	zip_uint64_t getMemoryLimit(void) const
+	{
+		return memoryLimit;
+	}
+
+	// 解压尺寸与压缩尺寸之比的上限，0为不限制，对读取到内存和写入文件都有效
+	void setMaxRatio(unsigned int ratio)
+	{
+		maxRatio = ratio;
+	}
+
+	unsigned int getMaxRatio(void) const
+	{
+		return maxRatio;
+	}
+
+	ReadError getLastReadError(void) const
+	{
+		return lastReadError;
+	}
+
+	// 批量读取的回调函数，data在回调返回后失效，返回false时停止读取
+	typedef bool (*ReadCallback)(const CZipEntry &entry, const void *data, zip_uint64_t length, void *userData);
+
+	/*
+	 * 读取过滤器选中的文件，返回交给回调的文件数，存档没有打开时返回-1
+	 * 超过内存或压缩比上限以及读取失败的文件跳过，不计入返回值，getLastReadError返回第一个失败的原因
+	 * 与extract相同，按条目在存档中的位置顺序读取并预读后续数据，不经过条目缓存
+	 */
+	int readEntries(const CZipEntryFilter &filter, ReadCallback callback, void *userData = NULL, State state = CURRENT) const;
+
+	/*
+	 * 设置解压时写文件的方式，NULL为在调用线程中直接写入，存档不负责释放output
+	 * 使用CZipAsyncFileOutput时文件的创建、写入和关闭由后台线程完成，extract和writeEntry返回前等待全部完成
+	 */
+	void setFileOutput(CZipFileOutput *output)
+	{
+		fileOutput = output;
+	}
+
+	CZipFileOutput *getFileOutput(void) const
+	{
+		return fileOutput;
+	}
+
+	// 把条目内容写入到文件
 	bool writeEntry(const std::string &zipEntry, const std::string &fileName, State state = CURRENT) const;
 	bool writeEntry(const CZipEntry &zipEntry, const std::string &fileName, State state = CURRENT) const;
 
-	// ɾĿ
+	// 把条目内容写入到文件，同时在后台线程计算SHA-256，成功时在manifest中加入一条记录
+	bool writeEntry(const CZipEntry &zipEntry, const std::string &fileName, CZipHashManifest &manifest, State state = CURRENT) const;
+
+	// 删除条目
 	int deleteEntry(const CZipEntry &entry) const;
 	int deleteEntry(const std::string &entry) const;
 
-	// Ŀ
+	// 重命名条目
 	int renameEntry(const CZipEntry &entry, const std::string &newName) const;
 	int renameEntry(const std::string &entry, const std::string &newName) const;
 
-	// ļzip浵
+	// 添加文件到zip存档
 	bool addFile(const std::string &entryName, const std::string &file) const;
 
-	// ݵzip浵
+	// 添加数据到zip存档
 	bool addData(const std::string &entryName, const void *data, unsigned int length, bool freeData = false) const;
 
-	// Ŀ¼Ŀzip浵entryNameĿ¼('/'β)
+	// 添加目录条目到zip存档，entryName必须是目录(以'/'结尾)
 	bool addEntry(const std::string &entryName) const;
 
-	// UTF8ת
+	// UTF8编码转换
 #define Utf8ToAscii(str) (isUtf8 ? ConvertUtf8ToMultiBytes(str) : str)
 #define AsciiToUtf8(str) (isUtf8 ? ConvertMultiBytesToUtf8(str) : str)
 #define DEFAULLT_ENC_FLAG (isUtf8 ? ZIP_FL_ENC_UTF_8 : ZIP_FL_ENC_GUESS)
 
-	// ѹzip浵
+	// 解压zip存档
 	void extract(const std::string &folderName);
 
-	// Ŀ¼zip浵
-	bool addFolder(const std::string &entryName, const std::string &folderName);
+	/*
+	 * 解压过滤器选中的文件，返回解压的文件数
+	 * stripPrefix不为空时只解压该前缀下的条目，输出路径去掉前缀
+	 * 条目按在存档中的位置顺序解压，对存档只做一次向前的顺序读取
+	 * manifest不为NULL时同时计算每个文件的SHA-256，加入到manifest
+	 */
+	int extract(const std::string &folderName, const CZipEntryFilter &filter, const std::string &stripPrefix = "",
+		CZipHashManifest *manifest = NULL);
 
-	// ϲ·
-	std::string concatPath(const std::string &strDir, const std::string &strFile, char slash = '\\');
+	// addFolder的选项
+	struct FolderOptions
+	{
+		zip_uint64_t smallFileSize;    // 不超过此尺寸的文件立即读入内存
+		zip_uint64_t maxMemory;        // 读入内存的小文件总字节数上限，超过后按大文件处理
+		size_t maxOpenFiles;           // 同时打开的文件句柄上限，也是每批读取的文件数
+		size_t scanThreads;            // 扫描目录的线程数
+		bool deduplicate;              // 内容相同的文件只压缩一次
 
-	// Ŀ¼
-	void createFolder(const std::string &folderName);
+		FolderOptions(void) : smallFileSize(64 * 1024), maxMemory(256 * 1024 * 1024), maxOpenFiles(64), scanThreads(4),
+			deduplicate(false) {}
+	};
+
+	/*
+	 * 添加目录到zip存档
+	 * 先用多个线程扫描出全部文件，再一次性添加，已创建的目录条目记录在集合中不重复查找
+	 * 小文件每批最多maxOpenFiles个同时以重叠I/O读入存档的内存池，读完立即关闭句柄，
+	 * 大文件仍由libzip在close时逐个打开读取，任何时候打开的句柄数都有上限
+	 * deduplicate时内容相同的文件先压缩到临时存档，每个文件仍是独立的条目，直接复制压缩数据和crc
+	 */
+	bool addFolder(const std::string &entryName, const std::string &folderName, const FolderOptions &options = FolderOptions());
 
-	// ȡĿ¼·
-	std::string getFolderPath(const std::string &filePath);
+	// 合并路径
+	static std::string concatPath(const std::string &strDir, const std::string &strFile, char slash = '\\');
 
-	// time_t ת FileTime
-	void TimetToFileTime(time_t t, LPFILETIME pft) const;
+	// 创建目录
+	static void createFolder(const std::string &folderName);
+
+	// 获取目录路径
+	static std::string getFolderPath(const std::string &filePath);
+
+	// time_t 转成 FileTime
+	static void TimetToFileTime(time_t t, LPFILETIME pft);
+
+	// FileTime 转成 time_t
+	static time_t FileTimeToTimet(const FILETIME &ft);
 
 private:
 	std::string path;
+	std::vector<char> *buffer;
 	zip *zipHandle;
 	OpenMode mode;
 	std::string password;
 	bool isUtf8;
 
-	// ZipEntry
+	CZipEntryCache *cache;
+	zip_uint64_t serial;                // unique per open, keys the cache
+	mutable zip_uint64_t generation;    // bumped whenever CURRENT content may change
+
+	// direct access to the archive bytes for range reads, opened on demand
+	mutable CZipDirectory *rawDirectory;
+	mutable CZipRandomInput *rawInput;
+	mutable HANDLE rawFile;
+	mutable bool rawFailed;    // the directory on disk is unusable until close
+	mutable std::map<zip_uint64_t, CZipEntryIndex> entryIndexes;
+	mutable std::set<zip_uint64_t> failedIndexes;    // entries whose index could not be built
+
+	zip_uint64_t memoryLimit;
+	unsigned int maxRatio;
+	mutable ReadError lastReadError;
+
+	bool compactOnClose;
+	mutable bool onlyDeletes;    // nothing but deletions since open
+	CZipFileOutput *fileOutput;
+	CZipMemoryResource *memoryResource;
+	const CZipEntryOrder *entryOrder;
+
+	CZipArena arena;             // small files read by addFolder, freed after close
+	std::vector<CZipArchive *> sharedArchives;    // compressed duplicate contents, deleted after close
+
+	// 创建ZipEntry
 	CZipEntry createEntry(struct zip_stat *stat) const;
 
+	// 按索引读取条目，不检查条目所属的存档
+	void *readIndex(zip_uint64_t index, zip_uint64_t size, bool asText, State state) const;
+	bool readIndex(zip_uint64_t index, zip_uint64_t size, bool asText, State state, CZipBuffer &data) const;
+	bool writeIndex(zip_uint64_t index, time_t time, const std::string &fileName, State state, CZipHashManifest *manifest = NULL,
+		CZipReadahead *readahead = NULL) const;
+	bool loadIndex(zip_uint64_t index, zip_uint64_t size, State state, std::vector<char> &data) const;
+
+	// 按内存和压缩比限制读取条目，缓冲区随实际解压的数据增长，不超过目录中的尺寸
+	// Buffer为CZipBuffer，或直接填充std::vector<char>的适配器(条目缓存不再复制一次)
+	template <class Buffer>
+	bool readLimited(zip_uint64_t index, zip_uint64_t size, bool asText, State state, Buffer &data, CZipReadahead *readahead = NULL) const;
+	ReadError checkLimits(zip_uint64_t index, zip_uint64_t size, State state, bool inMemory) const;
+	CZipEntryCache::Buffer readCached(zip_uint64_t index, zip_uint64_t size, State state) const;
+
+	// 按过滤器选出条目索引
+	void selectEntries(const CZipEntryFilter &filter, std::vector<zip_uint64_t> &indices, State state) const;
+
+	// 解析存档的中央目录，得到条目在存档中的位置
+	bool readDirectory(CZipDirectory &directory) const;
+
+	// 把条目索引按在存档中的位置排序，并准备预读，返回打开期间缓存的中央目录，无法排序时返回NULL
+	const CZipDirectory *orderEntries(std::vector<zip_uint64_t> &indices, CZipReadahead &readahead) const;
+	static void adviseEntry(zip_uint64_t index, const CZipDirectory *directory, CZipReadahead &readahead);
+
+	// 打开存档的原始数据，条目数据未修改时才能直接读取
+	bool openRaw(void) const;
+	void closeRaw(void) const;
+	bool isRawEntry(const CZipEntry &zipEntry) const;
+	zip_int64_t readRangeSequential(zip_uint64_t index, zip_uint64_t offset, void *data, size_t length, State state) const;
+
+	enum CompactResult
+	{
+		COMPACT_DONE,       // 已在原文件中压缩，zipHandle已关闭
+		COMPACT_SKIPPED,    // 不能压缩，zipHandle仍然打开，由zip_close写入
+		COMPACT_FAILED      // 压缩和回退都失败，zipHandle已关闭
+	};
+
+	// 在原文件中压缩只有删除的存档
+	CompactResult compact(void);
+
+	// 按entryOrder重写已关闭的存档，names为关闭前按索引顺序的条目名称
+	bool arrangeEntries(const std::vector<std::string> &names);
+
+	/*
+	 * 同时读取files中[first, last)的小文件并添加到存档，大文件或读取失败的文件由libzip在close时读取
+	 * shared[i]不小于0的文件从最后一个临时存档复制压缩数据
+	 */
+	bool addFolderBatch(const std::vector<CZipFolderScanner::File> &files, size_t first, size_t last, const std::vector<zip_int64_t> &shared,
+		const FolderOptions &options, std::set<std::string> &directories);
+
+	// 把有重复的内容压缩到一个临时存档，shared[i]为files[i]在临时存档中的索引，没有重复时为-1
+	bool compressShared(const std::vector<CZipFolderScanner::File> &files, std::vector<zip_int64_t> &shared);
+	void closeShared(void);
+
+	// 创建读取整个文件的libzip数据源
+	zip_source *createFileSource(const std::string &file) const;
+
+	// 添加条目及其父目录条目，directories为已确认存在的目录
+	bool addFolderEntry(const std::string &entryName, zip_source *source, time_t time, std::set<std::string> &directories);
+
 	CZipArchive(const CZipArchive &zf);
 	CZipArchive &operator=(const CZipArchive &);
 };
@@ -176,6 +476,7 @@ private:
 class CZipEntry
 {
 	friend class CZipArchive;
+	friend class CZipReadPool;
 
 public:
 	CZipEntry(void) : zipFile(NULL), index(0), time(0), method(-1), size(0), sizeComp(0), crc(0)  {}
@@ -201,13 +502,13 @@ public:
 		return method;
 	}
 
-	// ļδѹߴ
+	// 返回文件未压缩尺寸
 	zip_uint64_t getSize(void) const
 	{
 		return size;
 	}
 
-	// ļѹߴ
+	// 返回文件压缩尺寸
 	zip_uint64_t getInflatedSize(void) const
 	{
 		return sizeComp;
@@ -0,0 +1,64 @@
+#include "stdafx.h"
+#include "ZipArena.h"
+
+using namespace std;
+
+#define ARENA_ALIGNMENT		16
+
+CZipArena::CZipArena(size_t blockSize /*= 4 * 1024 * 1024*/) : blockSize(blockSize), current(NULL), left(0), size(0)
+{
+
+}
+
+CZipArena::~CZipArena(void)
+{
+	clear();
+}
+
+void *CZipArena::allocate(size_t length)
+{
+	size_t aligned = (length + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+	if (aligned == 0)
+		aligned = ARENA_ALIGNMENT;
+
+	// large allocations would waste the rest of a shared block
+	if (aligned > blockSize / 4)
+	{
+		char *block = (char *)malloc(aligned);
+		if (block == NULL)
+			return NULL;
+
+		blocks.push_back(block);
+		size += length;
+		return block;
+	}
+
+	if (aligned > left)
+	{
+		char *block = (char *)malloc(blockSize);
+		if (block == NULL)
+			return NULL;
+
+		blocks.push_back(block);
+		current = block;
+		left = blockSize;
+	}
+
+	char *data = current;
+	current += aligned;
+	left -= aligned;
+	size += length;
+	return data;
+}
+
+void CZipArena::clear(void)
+{
+	vector<char *>::iterator it;
+	for (it = blocks.begin(); it != blocks.end(); ++it)
+		free(*it);
+
+	blocks.clear();
+	current = NULL;
+	left = 0;
+	size = 0;
+}
@@ -0,0 +1,39 @@
+#ifndef ZIPARENA_H
+#define	ZIPARENA_H
+
+#include <vector>
+
+/*
+ * 只增长的内存池，按块向系统申请内存，分配的内存在clear或析构时一起释放
+ * 用于批量读入的小文件，数据须在存档关闭前保持有效
+ */
+class CZipArena
+{
+public:
+	CZipArena(size_t blockSize = 4 * 1024 * 1024);
+	virtual ~CZipArena(void);
+
+	// 分配length字节，超过块尺寸四分之一的分配单独占用一块
+	void *allocate(size_t length);
+
+	// 释放所有分配的内存
+	void clear(void);
+
+	// 已分配的字节数
+	size_t getSize(void) const
+	{
+		return size;
+	}
+
+private:
+	size_t blockSize;
+	std::vector<char *> blocks;
+	char *current;    // free space in the last shared block
+	size_t left;
+	size_t size;
+
+	CZipArena(const CZipArena &);
+	CZipArena &operator=(const CZipArena &);
+};
+
+#endif
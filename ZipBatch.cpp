@@ -0,0 +1,359 @@
+#include "stdafx.h"
+#include <set>
+#include <zip.h>
+#include "ZipBatch.h"
+
+using namespace std;
+
+namespace
+{
+	const size_t NO_OPERATION = (size_t)-1;
+
+	bool HasPrefix(const string &name, const string &prefix)
+	{
+		return name.size() >= prefix.size() && name.compare(0, prefix.size(), prefix) == 0;
+	}
+}
+
+size_t CZipBatch::push(Type type, const string &name, const string &target)
+{
+	Operation operation;
+	operation.type = type;
+	operation.name = name;
+	operation.target = target;
+	operation.data = NULL;
+	operation.length = 0;
+	operation.freeData = false;
+	operation.consumed = false;
+	operation.result = RESULT_PENDING;
+	operation.affected = 0;
+	operations.push_back(operation);
+	return operations.size() - 1;
+}
+
+size_t CZipBatch::addFile(const string &entryName, const string &file)
+{
+	return push(ADD_FILE, entryName, file);
+}
+
+size_t CZipBatch::addData(const string &entryName, const void *data, unsigned int length, bool freeData)
+{
+	size_t index = push(ADD_DATA, entryName, string());
+	operations[index].data = data;
+	operations[index].length = length;
+	operations[index].freeData = freeData;
+	return index;
+}
+
+size_t CZipBatch::addEntry(const string &entryName)
+{
+	return push(ADD_DIRECTORY, entryName, string());
+}
+
+size_t CZipBatch::renameEntry(const string &entryName, const string &newName)
+{
+	return push(RENAME_ENTRY, entryName, newName);
+}
+
+size_t CZipBatch::deleteEntry(const string &entryName)
+{
+	return push(DELETE_ENTRY, entryName, string());
+}
+
+void CZipBatch::clear(void)
+{
+	operations.clear();
+}
+
+int CZipBatch::apply(void)
+{
+	if (!archive.isOpen() || archive.mode == CZipArchive::READ_ONLY)
+		return -1;
+
+	// the only pass over the entry table
+	vector<CZipEntry> snapshot = archive.getEntries();
+	Table table;
+	vector<CZipEntry>::const_iterator it;
+	for (it = snapshot.begin(); it != snapshot.end(); ++it)
+	{
+		Slot slot = { (zip_int64_t)it->getIndex(), NO_OPERATION, NO_OPERATION };
+		table.insert(make_pair(it->getName(), slot));
+	}
+
+	zip_int64_t count = archive.getEntriesCount();
+	vector<size_t> deletedBy(count > 0 ? (size_t)count : 0, NO_OPERATION);
+	size_t first = 0;
+	while (first < operations.size() && operations[first].result != RESULT_PENDING)
+		++first;
+
+	for (size_t i = first; i < operations.size(); ++i)
+		operations[i].result = simulate(i, table, deletedBy);
+
+	++archive.generation;    //invalidates cached CURRENT content
+	commit(table, snapshot, deletedBy);
+
+	int succeeded = 0;
+	for (size_t i = first; i < operations.size(); ++i)
+	{
+		Operation &operation = operations[i];
+		if (operation.result == RESULT_OK)
+		{
+			++succeeded;
+			if (operation.type != DELETE_ENTRY)
+				archive.onlyDeletes = false;
+		}
+
+		// data that never reached libzip, failed or replaced within the batch
+		if (operation.type == ADD_DATA && operation.freeData && !operation.consumed)
+		{
+			free((void *)operation.data);
+			operation.data = NULL;
+		}
+	}
+	return succeeded;
+}
+
+void CZipBatch::addParents(const string &name, size_t operation, Table &table)
+{
+	size_t nextSlash = name.find(DIRECTORY_SEPARATOR);
+	while (nextSlash != string::npos)
+	{
+		string parent = name.substr(0, nextSlash + 1);
+		if (table.find(parent) == table.end())
+		{
+			Slot slot = { -1, NO_OPERATION, operation };
+			table.insert(make_pair(parent, slot));
+		}
+		nextSlash = name.find(DIRECTORY_SEPARATOR, nextSlash + 1);
+	}
+}
+
+CZipBatch::Result CZipBatch::simulate(size_t index, Table &table, vector<size_t> &deletedBy)
+{
+	Operation &operation = operations[index];
+	const string &name = operation.name;
+	switch (operation.type)
+	{
+	case ADD_FILE:
+	case ADD_DATA:
+		{
+			if (name.empty() || IS_DIRECTORY(name))
+				return RESULT_INVALID_NAME;
+
+			// an existing file keeps its index and gets replaced
+			Table::iterator it = table.find(name);
+			if (it != table.end())
+			{
+				it->second.source = index;
+				it->second.owner = index;
+			}
+			else
+			{
+				Slot slot = { -1, index, index };
+				table.insert(make_pair(name, slot));
+			}
+			addParents(name, index, table);
+			operation.affected = 1;
+			return RESULT_OK;
+		}
+
+	case ADD_DIRECTORY:
+		if (!IS_DIRECTORY(name))
+			return RESULT_INVALID_NAME;
+
+		addParents(name, index, table);
+		operation.affected = 1;
+		return RESULT_OK;
+
+	case RENAME_ENTRY:
+		{
+			const string &newName = operation.target;
+			Table::iterator it = table.find(name);
+			if (it == table.end())
+				return RESULT_NOT_FOUND;
+
+			if (newName.empty() || IS_DIRECTORY(newName) != IS_DIRECTORY(name))
+				return RESULT_INVALID_NAME;
+
+			if (newName == name)
+				return RESULT_OK;
+
+			// a directory moves with everything below it
+			vector<pair<string, Slot> > moved;
+			if (IS_DIRECTORY(name))
+			{
+				while (it != table.end() && HasPrefix(it->first, name))
+				{
+					moved.push_back(make_pair(newName + it->first.substr(name.size()), it->second));
+					table.erase(it++);
+				}
+			}
+			else
+			{
+				moved.push_back(make_pair(newName, it->second));
+				table.erase(it);
+			}
+
+			size_t i;
+			for (i = 0; i < moved.size(); ++i)
+			{
+				if (table.find(moved[i].first) != table.end())
+					break;
+			}
+
+			if (i < moved.size())
+			{
+				// put everything back under the old names
+				string oldName;
+				for (i = 0; i < moved.size(); ++i)
+				{
+					oldName = name + moved[i].first.substr(newName.size());
+					table.insert(make_pair(oldName, moved[i].second));
+				}
+				return RESULT_CONFLICT;
+			}
+
+			for (i = 0; i < moved.size(); ++i)
+			{
+				moved[i].second.owner = index;
+				table.insert(moved[i]);
+			}
+			addParents(newName, index, table);
+			operation.affected = (int)moved.size();
+			return RESULT_OK;
+		}
+
+	case DELETE_ENTRY:
+		{
+			Table::iterator it = table.find(name);
+			if (it == table.end())
+				return RESULT_NOT_FOUND;
+
+			int counter = 0;
+			do
+			{
+				if (it->second.index >= 0 && (size_t)it->second.index < deletedBy.size())
+					deletedBy[(size_t)it->second.index] = index;
+				table.erase(it++);
+				++counter;
+			} while (IS_DIRECTORY(name) && it != table.end() && HasPrefix(it->first, name));
+
+			operation.affected = counter;
+			return RESULT_OK;
+		}
+	}
+	return RESULT_INVALID_NAME;
+}
+
+void CZipBatch::commit(const Table &table, const vector<CZipEntry> &snapshot, const vector<size_t> &deletedBy)
+{
+	// names go through the same conversion macros as the archive's own methods
+	zip *zipHandle = archive.zipHandle;
+	bool isUtf8 = archive.isUtf8;
+
+	// deletions first, they free the names that renames and additions may reuse
+	for (size_t i = 0; i < deletedBy.size(); ++i)
+	{
+		if (deletedBy[i] != NO_OPERATION && zip_delete(zipHandle, i) != 0)
+			fail(deletedBy[i]);
+	}
+
+	map<zip_int64_t, string> originalNames;
+	vector<CZipEntry>::const_iterator eit;
+	for (eit = snapshot.begin(); eit != snapshot.end(); ++eit)
+		originalNames[(zip_int64_t)eit->getIndex()] = eit->getName();
+
+	// renamed entries still holding a name that another one takes move aside first,
+	// so swaps and chains of renames never collide
+	vector<pair<zip_int64_t, Table::const_iterator> > renames;
+	set<string> targets;
+	Table::const_iterator it;
+	for (it = table.begin(); it != table.end(); ++it)
+	{
+		if (it->second.index < 0 || originalNames[it->second.index] == it->first)
+			continue;
+
+		renames.push_back(make_pair(it->second.index, it));
+		targets.insert(it->first);
+	}
+
+	char suffix[32];
+	for (size_t i = 0; i < renames.size(); ++i)
+	{
+		const string &oldName = originalNames[renames[i].first];
+		if (targets.find(oldName) == targets.end())
+			continue;
+
+		string temporary;
+		int serial = 0;
+		do
+		{
+			sprintf_s(suffix, sizeof(suffix), ".batch%d", serial++);
+			temporary = AsciiToUtf8(oldName) + suffix;
+		} while (zip_name_locate(zipHandle, temporary.c_str(), 0) >= 0);
+
+		if (zip_file_rename(zipHandle, renames[i].first, temporary.c_str(), DEFAULLT_ENC_FLAG) != 0)
+			fail(renames[i].second->second.owner);
+	}
+
+	for (size_t i = 0; i < renames.size(); ++i)
+	{
+		const string &newName = renames[i].second->first;
+		if (zip_file_rename(zipHandle, renames[i].first, AsciiToUtf8(newName).c_str(), DEFAULLT_ENC_FLAG) != 0)
+			fail(renames[i].second->second.owner);
+	}
+
+	// replaced contents keep their position, new entries follow in name order so parents come first
+	for (it = table.begin(); it != table.end(); ++it)
+	{
+		if (it->second.index >= 0 && it->second.source == NO_OPERATION)
+			continue;
+
+		if (!addSlot(it->first, it->second))
+		{
+			fail(it->second.owner);
+			fail(it->second.source);
+		}
+	}
+}
+
+bool CZipBatch::addSlot(const string &name, const Slot &slot)
+{
+	zip *zipHandle = archive.zipHandle;
+	bool isUtf8 = archive.isUtf8;
+	if (slot.source == NO_OPERATION)
+		return zip_dir_add(zipHandle, AsciiToUtf8(name).c_str(), DEFAULLT_ENC_FLAG) >= 0;
+
+	zip_source *source = createSource(slot.source);
+	if (source == NULL)
+		return false;
+
+	// the simulation freed the name, an entry still holding it must fail instead of being replaced
+	bool result;
+	if (slot.index >= 0)
+		result = zip_file_replace(zipHandle, slot.index, source, 0) == 0;
+	else
+		result = zip_file_add(zipHandle, AsciiToUtf8(name).c_str(), source, 0) >= 0;
+
+	if (!result)
+		zip_source_free(source);
+	return result;
+}
+
+zip_source *CZipBatch::createSource(size_t index)
+{
+	Operation &operation = operations[index];
+	if (operation.type == ADD_FILE)
+		return archive.createFileSource(operation.target);
+
+	zip_source *source = zip_source_buffer(archive.zipHandle, operation.data, operation.length, operation.freeData);
+	if (source != NULL)
+		operation.consumed = true;    //freed along with the source from now on
+	return source;
+}
+
+void CZipBatch::fail(size_t index)
+{
+	if (index != NO_OPERATION && operations[index].result == RESULT_OK)
+		operations[index].result = RESULT_FAILED;
+}
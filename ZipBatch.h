@@ -0,0 +1,126 @@
+#ifndef ZIPBATCH_H
+#define	ZIPBATCH_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "ZipArchive.h"
+
+/*
+ * 批量修改zip存档
+ * 先收集添加、重命名和删除操作，apply时只取一次条目表的快照，
+ * 在快照上按顺序模拟全部操作，一次性解决名称冲突和需要补充的父目录条目，
+ * 再把最终结果一次提交给libzip，每个操作单独记录结果
+ * 名称规则与CZipArchive的单个操作相同，目录名称以'/'结尾
+ */
+class CZipBatch
+{
+public:
+	enum Result
+	{
+		RESULT_PENDING,         // 尚未执行
+		RESULT_OK,
+		RESULT_NOT_FOUND,       // 源条目不存在
+		RESULT_CONFLICT,        // 目标名称已被其他条目占用
+		RESULT_INVALID_NAME,    // 名称为空，或文件/目录名称与条目类型不符
+		RESULT_FAILED           // libzip执行失败
+	};
+
+	CZipBatch(CZipArchive &archive) : archive(archive) {}
+
+	// 以下函数记录一个操作，返回操作序号
+
+	// 添加文件，同名文件条目被替换
+	size_t addFile(const std::string &entryName, const std::string &file);
+
+	// 添加数据，freeData时数据由libzip用free释放，操作没有执行时由apply释放
+	size_t addData(const std::string &entryName, const void *data, unsigned int length, bool freeData = false);
+
+	// 添加目录条目，entryName必须以'/'结尾，目录已存在时也成功
+	size_t addEntry(const std::string &entryName);
+
+	// 重命名条目，目录连同其下的所有条目一起重命名
+	size_t renameEntry(const std::string &entryName, const std::string &newName);
+
+	// 删除条目，目录连同其下的所有条目一起删除
+	size_t deleteEntry(const std::string &entryName);
+
+	/*
+	 * 执行所有未执行的操作，返回成功的操作数，存档没有以写模式打开时返回-1
+	 * 失败的操作不影响其他操作，之后的操作看到的是失败操作之前的状态
+	 */
+	int apply(void);
+
+	// 清除所有操作和结果
+	void clear(void);
+
+	size_t getCount(void) const
+	{
+		return operations.size();
+	}
+
+	Result getResult(size_t operation) const
+	{
+		return operations[operation].result;
+	}
+
+	// 操作影响的条目数，目录的重命名和删除包括其下的条目
+	int getAffected(size_t operation) const
+	{
+		return operations[operation].affected;
+	}
+
+private:
+	enum Type
+	{
+		ADD_FILE,
+		ADD_DATA,
+		ADD_DIRECTORY,
+		RENAME_ENTRY,
+		DELETE_ENTRY
+	};
+
+	struct Operation
+	{
+		Type type;
+		std::string name;
+		std::string target;    // new name, or the file to add
+		const void *data;
+		unsigned int length;
+		bool freeData;
+		bool consumed;         // the data was handed to libzip
+		Result result;
+		int affected;
+	};
+
+	// an entry of the simulated table
+	struct Slot
+	{
+		zip_int64_t index;     // libzip index, -1 for an entry added by the batch
+		size_t source;         // operation providing the content, npos for directories and untouched data
+		size_t owner;          // operation that failed if committing this entry fails
+	};
+
+	typedef std::map<std::string, Slot> Table;
+
+	CZipArchive &archive;
+	std::vector<Operation> operations;
+
+	size_t push(Type type, const std::string &name, const std::string &target);
+
+	// 在快照上模拟一个操作
+	Result simulate(size_t operation, Table &table, std::vector<size_t> &deletedBy);
+	void addParents(const std::string &name, size_t operation, Table &table);
+
+	// 把模拟结果提交给libzip
+	void commit(const Table &table, const std::vector<CZipEntry> &snapshot, const std::vector<size_t> &deletedBy);
+	bool addSlot(const std::string &name, const Slot &slot);
+	zip_source *createSource(size_t operation);
+	void fail(size_t operation);
+
+	CZipBatch(const CZipBatch &);
+	CZipBatch &operator=(const CZipBatch &);
+};
+
+#endif
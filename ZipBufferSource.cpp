@@ -0,0 +1,149 @@
+#include "stdafx.h"
+#include "ZipBufferSource.h"
+
+using namespace std;
+
+namespace
+{
+	struct BufferSource
+	{
+		vector<char> *buffer;
+		vector<char> output;
+		zip_uint64_t readOffset;
+		zip_uint64_t writeOffset;
+		zip_error_t error;
+	};
+
+	zip_int64_t BufferSourceCallback(void *userData, void *data, zip_uint64_t length, zip_source_cmd_t cmd)
+	{
+		BufferSource *source = (BufferSource *)userData;
+		vector<char> &buffer = *source->buffer;
+
+		switch (cmd)
+		{
+		case ZIP_SOURCE_OPEN:
+			source->readOffset = 0;
+			return 0;
+
+		case ZIP_SOURCE_READ:
+		{
+			zip_uint64_t available = buffer.size() > source->readOffset ? buffer.size() - source->readOffset : 0;
+			zip_uint64_t count = length < available ? length : available;
+			if (count > 0)
+				memcpy(data, &buffer[0] + source->readOffset, (size_t)count);
+			source->readOffset += count;
+			return (zip_int64_t)count;
+		}
+
+		case ZIP_SOURCE_CLOSE:
+			return 0;
+
+		case ZIP_SOURCE_STAT:
+		{
+			if (length < sizeof(struct zip_stat))
+			{
+				zip_error_set(&source->error, ZIP_ER_INVAL, 0);
+				return -1;
+			}
+
+			struct zip_stat *stat = (struct zip_stat *)data;
+			zip_stat_init(stat);
+			stat->size = buffer.size();
+			stat->comp_size = buffer.size();
+			stat->comp_method = ZIP_CM_STORE;
+			stat->encryption_method = ZIP_EM_NONE;
+			stat->valid = ZIP_STAT_SIZE | ZIP_STAT_COMP_SIZE | ZIP_STAT_COMP_METHOD | ZIP_STAT_ENCRYPTION_METHOD;
+			return sizeof(struct zip_stat);
+		}
+
+		case ZIP_SOURCE_ERROR:
+			return zip_error_to_data(&source->error, data, length);
+
+		case ZIP_SOURCE_FREE:
+			zip_error_fini(&source->error);
+			delete source;
+			return 0;
+
+		case ZIP_SOURCE_SEEK:
+		{
+			zip_int64_t offset = zip_source_seek_compute_offset(source->readOffset, buffer.size(), data, length, &source->error);
+			if (offset < 0)
+				return -1;
+			source->readOffset = offset;
+			return 0;
+		}
+
+		case ZIP_SOURCE_TELL:
+			return (zip_int64_t)source->readOffset;
+
+		case ZIP_SOURCE_BEGIN_WRITE:
+			source->output.clear();
+			source->writeOffset = 0;
+			return 0;
+
+		case ZIP_SOURCE_WRITE:
+		{
+			zip_uint64_t end = source->writeOffset + length;
+			if (end > source->output.size())
+				source->output.resize((size_t)end);
+			if (length > 0)
+				memcpy(&source->output[0] + source->writeOffset, data, (size_t)length);
+			source->writeOffset = end;
+			return (zip_int64_t)length;
+		}
+
+		case ZIP_SOURCE_SEEK_WRITE:
+		{
+			zip_int64_t offset = zip_source_seek_compute_offset(source->writeOffset, source->output.size(), data, length, &source->error);
+			if (offset < 0)
+				return -1;
+			source->writeOffset = offset;
+			return 0;
+		}
+
+		case ZIP_SOURCE_TELL_WRITE:
+			return (zip_int64_t)source->writeOffset;
+
+		case ZIP_SOURCE_COMMIT_WRITE:
+			// the new archive replaces the caller's buffer without a copy
+			buffer.swap(source->output);
+			vector<char>().swap(source->output);
+			return 0;
+
+		case ZIP_SOURCE_ROLLBACK_WRITE:
+			vector<char>().swap(source->output);
+			return 0;
+
+		case ZIP_SOURCE_REMOVE:
+			vector<char>().swap(buffer);
+			return 0;
+
+		case ZIP_SOURCE_SUPPORTS:
+			return zip_source_make_command_bitmap(ZIP_SOURCE_OPEN, ZIP_SOURCE_READ, ZIP_SOURCE_CLOSE, ZIP_SOURCE_STAT,
+				ZIP_SOURCE_ERROR, ZIP_SOURCE_FREE, ZIP_SOURCE_SEEK, ZIP_SOURCE_TELL,
+				ZIP_SOURCE_BEGIN_WRITE, ZIP_SOURCE_COMMIT_WRITE, ZIP_SOURCE_ROLLBACK_WRITE, ZIP_SOURCE_WRITE,
+				ZIP_SOURCE_SEEK_WRITE, ZIP_SOURCE_TELL_WRITE, ZIP_SOURCE_REMOVE, -1);
+
+		default:
+			zip_error_set(&source->error, ZIP_ER_OPNOTSUPP, 0);
+			return -1;
+		}
+	}
+}
+
+zip_source *CreateZipBufferSource(std::vector<char> &buffer, zip_error_t *error)
+{
+	BufferSource *source = new BufferSource;
+	source->buffer = &buffer;
+	source->readOffset = 0;
+	source->writeOffset = 0;
+	zip_error_init(&source->error);
+
+	zip_source *zipSource = zip_source_function_create(BufferSourceCallback, source, error);
+	if (zipSource == NULL)
+	{
+		zip_error_fini(&source->error);
+		delete source;
+	}
+	return zipSource;
+}
@@ -0,0 +1,15 @@
+#ifndef ZIPBUFFERSOURCE_H
+#define	ZIPBUFFERSOURCE_H
+
+#include <vector>
+#include <zip.h>
+
+/*
+ * 创建以buffer为存储的zip_source
+ * 读取直接使用buffer中的数据，写入时先写到新缓冲区，提交时与buffer交换，
+ * 整个过程不经过文件系统，也不复制存档数据
+ * buffer须在zip_source释放前保持有效
+ */
+zip_source *CreateZipBufferSource(std::vector<char> &buffer, zip_error_t *error);
+
+#endif
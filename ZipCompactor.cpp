@@ -0,0 +1,369 @@
+#include "stdafx.h"
+#include <algorithm>
+#include <zlib.h>
+#include "ZipCompactor.h"
+#include "ZipDirectory.h"
+#include "ZipFormat.h"
+
+using namespace std;
+
+#define JOURNAL_MAGIC			0x4C4A435A    // "ZCJL"
+#define JOURNAL_VERSION			1
+#define JOURNAL_HEADER_SIZE		32
+#define JOURNAL_MOVE_SIZE		24
+#define JOURNAL_SLOT_SIZE		64
+#define JOURNAL_ALIGNMENT		4096
+#define COMPACT_CHUNK_SIZE		(8 * 1024 * 1024)
+
+namespace
+{
+	bool WriteAt(HANDLE hFile, zip_uint64_t offset, const void *data, size_t length)
+	{
+		const char *bytes = (const char *)data;
+		while (length > 0)
+		{
+			OVERLAPPED overlapped = {0};
+			overlapped.Offset = (DWORD)(offset & 0xFFFFFFFF);
+			overlapped.OffsetHigh = (DWORD)(offset >> 32);
+
+			DWORD toWrite = length > 0x40000000 ? 0x40000000 : (DWORD)length;
+			DWORD dwWritten = 0;
+			if (!WriteFile(hFile, bytes, toWrite, &dwWritten, &overlapped) || dwWritten == 0)
+				return false;
+
+			bytes += dwWritten;
+			offset += dwWritten;
+			length -= dwWritten;
+		}
+		return true;
+	}
+
+	zip_uint32_t Checksum(const void *data, size_t length)
+	{
+		return (zip_uint32_t)crc32(crc32(0L, Z_NULL, 0), (const Bytef *)data, (uInt)length);
+	}
+
+	struct OffsetLess
+	{
+		const CZipDirectory &directory;
+
+		OffsetLess(const CZipDirectory &directory) : directory(directory) {}
+
+		bool operator()(size_t a, size_t b) const
+		{
+			return directory.getEntry(a).offset < directory.getEntry(b).offset;
+		}
+	};
+}
+
+bool CZipCompactor::plan(const CZipDirectory &source, const vector<bool> &keep)
+{
+	size_t count = source.getCount();
+	vector<size_t> order(count);
+	for (size_t i = 0; i < count; ++i)
+		order[i] = i;
+	sort(order.begin(), order.end(), OffsetLess(source));
+
+	// every entry owns the bytes up to the next entry, data descriptor included
+	vector<zip_uint64_t> offsets(count);
+	zip_uint64_t position = count > 0 ? source.getEntry(order[0]).offset : 0;
+	moves.clear();
+	for (size_t i = 0; i < count; ++i)
+	{
+		const CZipDirectoryEntry &entry = source.getEntry(order[i]);
+		zip_uint64_t end = i + 1 < count ? source.getEntry(order[i + 1]).offset : source.getDirectoryOffset();
+		if (end <= entry.offset)
+			return false;    //entries sharing data cannot be moved apart
+
+		if (!keep[order[i]])
+			continue;
+
+		zip_uint64_t length = end - entry.offset;
+		offsets[order[i]] = position;
+		if (position != entry.offset)
+		{
+			if (!moves.empty() && moves.back().source + moves.back().length == entry.offset &&
+				moves.back().target + moves.back().length == position)
+			{
+				moves.back().length += length;
+			}
+			else
+			{
+				Move move = { entry.offset, position, length };
+				moves.push_back(move);
+			}
+		}
+		position += length;
+	}
+
+	// the new central directory keeps the original order and records
+	directoryOffset = position;
+	directory.clear();
+	zip_uint64_t kept = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (!keep[i])
+			continue;
+
+		string record = source.getEntry(i).record;
+		if (!CZipDirectory::setRecordOffset(record, offsets[i]))
+			return false;
+
+		directory.append(record);
+		++kept;
+	}
+
+	CZipDirectory::appendEnd(directory, kept, directoryOffset, directory.size(), source.getComment());
+
+	return true;
+}
+
+bool CZipCompactor::compact(const vector<bool> &keep)
+{
+	HANDLE hFile = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	CZipHandleRandomInput input(hFile);
+	CZipDirectory source;
+	if (!source.read(input) || source.getCount() != keep.size() || !plan(source, keep))
+	{
+		CloseHandle(hFile);
+		return false;
+	}
+
+	string journalPath = getJournalPath();
+	HANDLE hJournal = CreateFileA(journalPath.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL);
+	if (hJournal == INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(hFile);
+		return false;
+	}
+
+	Progress progress = { 1, 0, 0, 0, 0 };
+	bool journaled = writeJournal(hJournal) && writeProgress(hJournal, progress);
+	bool result = journaled && run(hFile, hJournal, progress);
+
+	CloseHandle(hJournal);
+	CloseHandle(hFile);
+
+	// the archive is untouched until the journal is complete,
+	// after that the journal is kept so that recover can finish the work
+	if (result || !journaled)
+		DeleteFileA(journalPath.c_str());
+
+	return result;
+}
+
+bool CZipCompactor::hasJournal(void) const
+{
+	return GetFileAttributesA(getJournalPath().c_str()) != INVALID_FILE_ATTRIBUTES;
+}
+
+bool CZipCompactor::recover(void)
+{
+	if (!hasJournal())
+		return true;
+
+	string journalPath = getJournalPath();
+	HANDLE hJournal = CreateFileA(journalPath.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+	if (hJournal == INVALID_HANDLE_VALUE)
+		return false;
+
+	Progress progress;
+	if (!readJournal(hJournal, progress))
+	{
+		// an incomplete journal means the archive was never touched
+		CloseHandle(hJournal);
+		return DeleteFileA(journalPath.c_str()) != FALSE;
+	}
+
+	HANDLE hFile = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(hJournal);
+		return false;
+	}
+
+	bool result = run(hFile, hJournal, progress);
+	CloseHandle(hFile);
+	CloseHandle(hJournal);
+
+	if (result)
+		DeleteFileA(journalPath.c_str());
+	return result;
+}
+
+bool CZipCompactor::writeJournal(HANDLE hJournal)
+{
+	string journal;
+	ZipPut32(journal, JOURNAL_MAGIC);
+	ZipPut32(journal, JOURNAL_VERSION);
+	ZipPut64(journal, moves.size());
+	ZipPut64(journal, directoryOffset);
+	ZipPut64(journal, directory.size());
+
+	vector<Move>::const_iterator it;
+	for (it = moves.begin(); it != moves.end(); ++it)
+	{
+		ZipPut64(journal, it->source);
+		ZipPut64(journal, it->target);
+		ZipPut64(journal, it->length);
+	}
+	journal.append(directory);
+	ZipPut32(journal, Checksum(journal.data(), journal.size()));
+
+	progressOffset = (journal.size() + JOURNAL_ALIGNMENT - 1) / JOURNAL_ALIGNMENT * JOURNAL_ALIGNMENT;
+	return WriteAt(hJournal, 0, journal.data(), journal.size()) && FlushFileBuffers(hJournal);
+}
+
+bool CZipCompactor::readJournal(HANDLE hJournal, Progress &progress)
+{
+	CZipHandleRandomInput input(hJournal);
+	unsigned char header[JOURNAL_HEADER_SIZE];
+	if (!input.readAt(0, header, sizeof(header)) ||
+		ZipGet32(header) != JOURNAL_MAGIC || ZipGet32(header + 4) != JOURNAL_VERSION)
+		return false;
+
+	zip_uint64_t moveCount = ZipGet64(header + 8);
+	zip_uint64_t directorySize = ZipGet64(header + 24);
+	zip_uint64_t fileSize = input.getSize();
+	if (moveCount > fileSize / JOURNAL_MOVE_SIZE || directorySize > fileSize)
+		return false;
+
+	size_t length = (size_t)(JOURNAL_HEADER_SIZE + moveCount * JOURNAL_MOVE_SIZE + directorySize);
+	if (length + 4 > fileSize)
+		return false;
+
+	vector<unsigned char> journal(length + 4);
+	if (!input.readAt(0, &journal[0], journal.size()) || ZipGet32(&journal[length]) != Checksum(&journal[0], length))
+		return false;
+
+	moves.resize((size_t)moveCount);
+	const unsigned char *p = &journal[JOURNAL_HEADER_SIZE];
+	for (size_t i = 0; i < moves.size(); ++i, p += JOURNAL_MOVE_SIZE)
+	{
+		moves[i].source = ZipGet64(p);
+		moves[i].target = ZipGet64(p + 8);
+		moves[i].length = ZipGet64(p + 16);
+	}
+	directoryOffset = ZipGet64(header + 16);
+	directory.assign((const char *)p, (size_t)directorySize);
+	progressOffset = (length + 4 + JOURNAL_ALIGNMENT - 1) / JOURNAL_ALIGNMENT * JOURNAL_ALIGNMENT;
+
+	// two alternating slots, a torn write leaves the other one intact
+	Progress start = { 0, 0, 0, 0, 0 };
+	progress = start;
+	for (int i = 0; i < 2; ++i)
+	{
+		unsigned char slot[36];
+		if (!input.readAt(progressOffset + i * JOURNAL_SLOT_SIZE, slot, sizeof(slot)))
+			continue;
+		if (ZipGet32(slot + 32) != Checksum(slot, 32))
+			continue;
+
+		Progress candidate;
+		candidate.sequence = ZipGet64(slot);
+		candidate.move = ZipGet64(slot + 8);
+		candidate.done = ZipGet64(slot + 16);
+		candidate.pending = ZipGet32(slot + 24);
+		candidate.crc = ZipGet32(slot + 28);
+		if (candidate.sequence > progress.sequence)
+			progress = candidate;
+	}
+
+	return progress.move <= moves.size() && progress.pending <= COMPACT_CHUNK_SIZE;
+}
+
+bool CZipCompactor::writeProgress(HANDLE hJournal, const Progress &progress)
+{
+	string slot;
+	ZipPut64(slot, progress.sequence);
+	ZipPut64(slot, progress.move);
+	ZipPut64(slot, progress.done);
+	ZipPut32(slot, progress.pending);
+	ZipPut32(slot, progress.crc);
+	ZipPut32(slot, Checksum(slot.data(), slot.size()));
+
+	zip_uint64_t offset = progressOffset + (progress.sequence % 2) * JOURNAL_SLOT_SIZE;
+	return WriteAt(hJournal, offset, slot.data(), slot.size()) && FlushFileBuffers(hJournal);
+}
+
+bool CZipCompactor::run(HANDLE hFile, HANDLE hJournal, Progress &progress)
+{
+	CZipHandleRandomInput input(hFile);
+	CZipHandleRandomInput journal(hJournal);
+	zip_uint64_t dataOffset = progressOffset + 2 * JOURNAL_SLOT_SIZE;
+	vector<char> buffer(COMPACT_CHUNK_SIZE);
+
+	// a chunk saved in the journal may have been half written, write it again
+	if (progress.pending > 0)
+	{
+		if (progress.move >= moves.size())
+			return false;
+
+		const Move &move = moves[(size_t)progress.move];
+		if (!journal.readAt(dataOffset, &buffer[0], progress.pending) || Checksum(&buffer[0], progress.pending) != progress.crc)
+			return false;
+		if (!WriteAt(hFile, move.target + progress.done, &buffer[0], progress.pending) || !FlushFileBuffers(hFile))
+			return false;
+
+		progress.done += progress.pending;
+		progress.pending = 0;
+		progress.crc = 0;
+		++progress.sequence;
+		if (!writeProgress(hJournal, progress))
+			return false;
+	}
+
+	while (progress.move < moves.size())
+	{
+		const Move &move = moves[(size_t)progress.move];
+		if (progress.done >= move.length)
+		{
+			++progress.move;
+			progress.done = 0;
+			continue;
+		}
+
+		zip_uint64_t remaining = move.length - progress.done;
+		size_t count = remaining < COMPACT_CHUNK_SIZE ? (size_t)remaining : COMPACT_CHUNK_SIZE;
+		if (!input.readAt(move.source + progress.done, &buffer[0], count))
+			return false;
+
+		// a chunk that overlaps its own source is copied to the journal first,
+		// otherwise the source stays intact until the chunk is recorded as done
+		if (count > move.source - move.target)
+		{
+			if (!WriteAt(hJournal, dataOffset, &buffer[0], count) || !FlushFileBuffers(hJournal))
+				return false;
+
+			progress.pending = (zip_uint32_t)count;
+			progress.crc = Checksum(&buffer[0], count);
+			++progress.sequence;
+			if (!writeProgress(hJournal, progress))
+				return false;
+		}
+
+		if (!WriteAt(hFile, move.target + progress.done, &buffer[0], count) || !FlushFileBuffers(hFile))
+			return false;
+
+		progress.done += count;
+		progress.pending = 0;
+		progress.crc = 0;
+		++progress.sequence;
+		if (!writeProgress(hJournal, progress))
+			return false;
+	}
+
+	// the new central directory goes right after the data, then the file is cut
+	if (!WriteAt(hFile, directoryOffset, directory.data(), directory.size()))
+		return false;
+
+	LARGE_INTEGER end;
+	end.QuadPart = (LONGLONG)(directoryOffset + directory.size());
+	if (!SetFilePointerEx(hFile, end, NULL, FILE_BEGIN) || !SetEndOfFile(hFile))
+		return false;
+
+	return FlushFileBuffers(hFile) != FALSE;
+}
@@ -0,0 +1,71 @@
+#ifndef ZIPCOMPACTOR_H
+#define	ZIPCOMPACTOR_H
+
+#include <string>
+#include <vector>
+#include <Windows.h>
+
+#include <zipconf.h>
+
+class CZipDirectory;
+
+/*
+ * 删除条目后在原文件中压缩zip存档，不创建临时文件
+ * 把第一个空洞之后保留的条目原始数据依次向前移动，重写中央目录并截断文件，
+ * I/O量只与第一个空洞之后的数据量有关
+ * 移动前把计划写入日志文件(存档路径 + ".compact")，每移动一块记录一次进度，
+ * 源和目标重叠的块先把数据写入日志，中断后用recover从日志继续完成压缩
+ */
+class CZipCompactor
+{
+public:
+	CZipCompactor(const std::string &zipPath) : path(zipPath) {}
+
+	/*
+	 * keep为每个中央目录条目是否保留(顺序与libzip的ORIGINAL索引相同)
+	 * 调用前存档不能被其他句柄打开
+	 */
+	bool compact(const std::vector<bool> &keep);
+
+	// 存档是否有未完成的压缩
+	bool hasJournal(void) const;
+
+	// 完成中断的压缩，没有日志时直接返回true
+	bool recover(void);
+
+	std::string getJournalPath(void) const
+	{
+		return path + ".compact";
+	}
+
+private:
+	struct Move
+	{
+		zip_uint64_t source;
+		zip_uint64_t target;
+		zip_uint64_t length;
+	};
+
+	struct Progress
+	{
+		zip_uint64_t sequence;
+		zip_uint64_t move;
+		zip_uint64_t done;       // bytes of the move already in place
+		zip_uint32_t pending;    // bytes of the next chunk saved in the journal
+		zip_uint32_t crc;
+	};
+
+	std::string path;
+	std::vector<Move> moves;
+	std::string directory;       // new central directory and end records
+	zip_uint64_t directoryOffset;
+	zip_uint64_t progressOffset;
+
+	bool plan(const CZipDirectory &source, const std::vector<bool> &keep);
+	bool writeJournal(HANDLE hJournal);
+	bool readJournal(HANDLE hJournal, Progress &progress);
+	bool writeProgress(HANDLE hJournal, const Progress &progress);
+	bool run(HANDLE hFile, HANDLE hJournal, Progress &progress);
+};
+
+#endif
@@ -0,0 +1,251 @@
+#include "stdafx.h"
+#include "ZipDirectory.h"
+#include "ZipFormat.h"
+
+using namespace std;
+
+bool CZipDirectory::read(CZipRandomInput &input)
+{
+	entries.clear();
+	directoryOffset = 0;
+	directorySize = 0;
+	comment.clear();
+
+	zip_uint64_t fileSize = input.getSize();
+	if (fileSize < ZIP_END_OF_CENTRAL_SIZE)
+		return false;
+
+	// the end of central directory record is followed by a comment of at most 64K
+	size_t tailSize = ZIP_END_OF_CENTRAL_SIZE + ZIP_UINT16_LIMIT;
+	if (tailSize > fileSize)
+		tailSize = (size_t)fileSize;
+
+	zip_uint64_t tailOffset = fileSize - tailSize;
+	vector<unsigned char> tail(tailSize);
+	if (!input.readAt(tailOffset, &tail[0], tailSize))
+		return false;
+
+	size_t end = tailSize - ZIP_END_OF_CENTRAL_SIZE;
+	for (;;)
+	{
+		if (ZipGet32(&tail[end]) == ZIP_END_OF_CENTRAL_SIG &&
+			end + ZIP_END_OF_CENTRAL_SIZE + ZipGet16(&tail[end + 20]) <= tailSize)
+			break;
+		if (end == 0)
+			return false;
+		--end;
+	}
+
+	const unsigned char *record = &tail[end];
+	zip_uint64_t endOffset = tailOffset + end;
+	zip_uint64_t count = ZipGet16(record + 10);
+	zip_uint64_t size = ZipGet32(record + 12);
+	zip_uint64_t offset = ZipGet32(record + 16);
+
+	if (count == ZIP_UINT16_LIMIT || size == ZIP_UINT32_LIMIT || offset == ZIP_UINT32_LIMIT)
+	{
+		unsigned char locator[ZIP64_END_LOCATOR_SIZE];
+		if (endOffset < ZIP64_END_LOCATOR_SIZE ||
+			!input.readAt(endOffset - ZIP64_END_LOCATOR_SIZE, locator, sizeof(locator)) ||
+			ZipGet32(locator) != ZIP64_END_LOCATOR_SIG)
+			return false;
+
+		unsigned char zip64End[ZIP64_END_OF_CENTRAL_SIZE];
+		if (!input.readAt(ZipGet64(locator + 8), zip64End, sizeof(zip64End)) ||
+			ZipGet32(zip64End) != ZIP64_END_OF_CENTRAL_SIG)
+			return false;
+
+		count = ZipGet64(zip64End + 32);
+		size = ZipGet64(zip64End + 40);
+		offset = ZipGet64(zip64End + 48);
+	}
+
+	if (offset > endOffset || size > endOffset - offset || size != (size_t)size)
+		return false;
+
+	vector<unsigned char> directory((size_t)size);
+	if (size > 0 && !input.readAt(offset, &directory[0], (size_t)size))
+		return false;
+
+	if (!readEntries(directory.empty() ? NULL : &directory[0], directory.size(), count))
+	{
+		entries.clear();
+		return false;
+	}
+
+	directoryOffset = offset;
+	directorySize = size;
+	comment.assign((const char *)record + ZIP_END_OF_CENTRAL_SIZE, ZipGet16(record + 20));
+	return true;
+}
+
+bool CZipDirectory::readEntries(const unsigned char *data, size_t length, zip_uint64_t count)
+{
+	// every record needs at least its fixed header
+	if (count > length / ZIP_CENTRAL_HEADER_SIZE)
+		return false;
+
+	entries.reserve((size_t)count);
+
+	size_t position = 0;
+	for (zip_uint64_t i = 0; i < count; ++i)
+	{
+		if (length - position < ZIP_CENTRAL_HEADER_SIZE)
+			return false;
+
+		const unsigned char *header = data + position;
+		if (ZipGet32(header) != ZIP_CENTRAL_HEADER_SIG)
+			return false;
+
+		zip_uint16_t nameLength = ZipGet16(header + 28);
+		zip_uint16_t extraLength = ZipGet16(header + 30);
+		zip_uint16_t commentLength = ZipGet16(header + 32);
+		size_t recordSize = ZIP_CENTRAL_HEADER_SIZE + nameLength + extraLength + commentLength;
+		if (length - position < recordSize)
+			return false;
+
+		CZipDirectoryEntry entry;
+		entry.flags = ZipGet16(header + 8);
+		entry.method = ZipGet16(header + 10);
+		entry.dosTime = ZipGet16(header + 12);
+		entry.dosDate = ZipGet16(header + 14);
+		entry.crc = ZipGet32(header + 16);
+		entry.sizeComp = ZipGet32(header + 20);
+		entry.size = ZipGet32(header + 24);
+		entry.offset = ZipGet32(header + 42);
+		entry.rawName.assign((const char *)header + ZIP_CENTRAL_HEADER_SIZE, nameLength);
+		entry.record.assign((const char *)header, recordSize);
+
+		const unsigned char *extra = header + ZIP_CENTRAL_HEADER_SIZE + nameLength;
+		for (size_t j = 0; j + 4 <= extraLength;)
+		{
+			zip_uint16_t id = ZipGet16(extra + j);
+			zip_uint16_t fieldLength = ZipGet16(extra + j + 2);
+			if (j + 4 + fieldLength > extraLength)
+				break;
+
+			if (id == ZIP64_EXTRA_ID)
+			{
+				const unsigned char *field = extra + j + 4;
+				const unsigned char *fieldEnd = field + fieldLength;
+				if (entry.size == ZIP_UINT32_LIMIT && field + 8 <= fieldEnd)
+				{
+					entry.size = ZipGet64(field);
+					field += 8;
+				}
+				if (entry.sizeComp == ZIP_UINT32_LIMIT && field + 8 <= fieldEnd)
+				{
+					entry.sizeComp = ZipGet64(field);
+					field += 8;
+				}
+				if (entry.offset == ZIP_UINT32_LIMIT && field + 8 <= fieldEnd)
+					entry.offset = ZipGet64(field);
+			}
+			j += 4 + fieldLength;
+		}
+
+		entries.push_back(entry);
+		position += recordSize;
+	}
+
+	return true;
+}
+
+zip_int64_t CZipDirectory::getDataOffset(CZipRandomInput &input, size_t index) const
+{
+	if (index >= entries.size())
+		return -1;
+
+	const CZipDirectoryEntry &entry = entries[index];
+	unsigned char header[ZIP_LOCAL_HEADER_SIZE];
+	if (!input.readAt(entry.offset, header, sizeof(header)) || ZipGet32(header) != ZIP_LOCAL_HEADER_SIG)
+		return -1;
+
+	// the local extra field may differ from the central one
+	zip_uint64_t dataOffset = entry.offset + ZIP_LOCAL_HEADER_SIZE + ZipGet16(header + 26) + ZipGet16(header + 28);
+	if (dataOffset + entry.sizeComp > directoryOffset)
+		return -1;
+
+	return (zip_int64_t)dataOffset;
+}
+
+bool CZipDirectory::setRecordOffset(string &record, zip_uint64_t offset)
+{
+	if (record.size() < ZIP_CENTRAL_HEADER_SIZE)
+		return false;
+
+	unsigned char *header = (unsigned char *)&record[0];
+	if (ZipGet32(header + 42) != ZIP_UINT32_LIMIT)
+	{
+		if (offset >= ZIP_UINT32_LIMIT)
+			return false;    //no room for a ZIP64 offset
+
+		ZipSet32(header + 42, (zip_uint32_t)offset);
+		return true;
+	}
+
+	zip_uint16_t nameLength = ZipGet16(header + 28);
+	zip_uint16_t extraLength = ZipGet16(header + 30);
+	if (ZIP_CENTRAL_HEADER_SIZE + nameLength + extraLength > record.size())
+		return false;
+
+	unsigned char *extra = header + ZIP_CENTRAL_HEADER_SIZE + nameLength;
+	for (size_t i = 0; i + 4 <= extraLength;)
+	{
+		zip_uint16_t id = ZipGet16(extra + i);
+		zip_uint16_t length = ZipGet16(extra + i + 2);
+		if (i + 4 + length > extraLength)
+			break;
+
+		if (id == ZIP64_EXTRA_ID)
+		{
+			// the offset follows the sizes that overflowed
+			unsigned char *field = extra + i + 4;
+			if (ZipGet32(header + 24) == ZIP_UINT32_LIMIT)
+				field += 8;
+			if (ZipGet32(header + 20) == ZIP_UINT32_LIMIT)
+				field += 8;
+			if (field + 8 > extra + i + 4 + length)
+				return false;
+
+			ZipSet64(field, offset);
+			return true;
+		}
+		i += 4 + length;
+	}
+	return false;
+}
+
+void CZipDirectory::appendEnd(string &out, zip_uint64_t count, zip_uint64_t directoryOffset, zip_uint64_t directorySize,
+	const string &comment)
+{
+	if (count >= ZIP_UINT16_LIMIT || directoryOffset >= ZIP_UINT32_LIMIT || directorySize >= ZIP_UINT32_LIMIT)
+	{
+		zip_uint64_t zip64EndOffset = directoryOffset + directorySize;
+		ZipPut32(out, ZIP64_END_OF_CENTRAL_SIG);
+		ZipPut64(out, ZIP64_END_OF_CENTRAL_SIZE - 12);
+		ZipPut16(out, ZIP_VERSION_ZIP64);
+		ZipPut16(out, ZIP_VERSION_ZIP64);
+		ZipPut32(out, 0);
+		ZipPut32(out, 0);
+		ZipPut64(out, count);
+		ZipPut64(out, count);
+		ZipPut64(out, directorySize);
+		ZipPut64(out, directoryOffset);
+
+		ZipPut32(out, ZIP64_END_LOCATOR_SIG);
+		ZipPut32(out, 0);
+		ZipPut64(out, zip64EndOffset);
+		ZipPut32(out, 1);
+	}
+
+	ZipPut32(out, ZIP_END_OF_CENTRAL_SIG);
+	ZipPut16(out, 0);
+	ZipPut16(out, 0);
+	ZipPut16(out, count >= ZIP_UINT16_LIMIT ? ZIP_UINT16_LIMIT : (zip_uint16_t)count);
+	ZipPut16(out, count >= ZIP_UINT16_LIMIT ? ZIP_UINT16_LIMIT : (zip_uint16_t)count);
+	ZipPut32(out, directorySize >= ZIP_UINT32_LIMIT ? ZIP_UINT32_LIMIT : (zip_uint32_t)directorySize);
+	ZipPut32(out, directoryOffset >= ZIP_UINT32_LIMIT ? ZIP_UINT32_LIMIT : (zip_uint32_t)directoryOffset);
+	ZipPut16(out, (zip_uint16_t)comment.size());
+	out.append(comment);
+}
@@ -0,0 +1,87 @@
+#ifndef ZIPDIRECTORY_H
+#define	ZIPDIRECTORY_H
+
+#include <string>
+#include <vector>
+
+#include <zipconf.h>
+#include "ZipStream.h"
+
+// 中央目录中的一条记录，名称为zip中的原生编码
+struct CZipDirectoryEntry
+{
+	std::string rawName;
+	zip_uint64_t offset;      // 本地文件头位置
+	zip_uint64_t size;
+	zip_uint64_t sizeComp;
+	zip_uint32_t crc;
+	zip_uint16_t flags;
+	zip_uint16_t method;
+	zip_uint16_t dosDate;
+	zip_uint16_t dosTime;
+	std::string record;       // 原始的中央目录记录
+};
+
+/*
+ * 直接解析存档的中央目录，得到每个条目在存档中的位置
+ * 条目顺序与libzip的ORIGINAL索引相同，支持ZIP64
+ */
+class CZipDirectory
+{
+public:
+	CZipDirectory(void) : directoryOffset(0), directorySize(0) {}
+
+	bool read(CZipRandomInput &input);
+
+	size_t getCount(void) const
+	{
+		return entries.size();
+	}
+
+	const CZipDirectoryEntry &getEntry(size_t index) const
+	{
+		return entries[index];
+	}
+
+	const std::vector<CZipDirectoryEntry> &getEntries(void) const
+	{
+		return entries;
+	}
+
+	// 中央目录的位置和尺寸，条目数据都在中央目录之前
+	zip_uint64_t getDirectoryOffset(void) const
+	{
+		return directoryOffset;
+	}
+
+	zip_uint64_t getDirectorySize(void) const
+	{
+		return directorySize;
+	}
+
+	// 原生编码的存档注释
+	std::string getComment(void) const
+	{
+		return comment;
+	}
+
+	// 读取本地文件头，返回条目数据的起始位置，失败时返回-1
+	zip_int64_t getDataOffset(CZipRandomInput &input, size_t index) const;
+
+	// 修改中央目录记录中的本地文件头位置，位置在ZIP64扩展字段中时修改扩展字段
+	static bool setRecordOffset(std::string &record, zip_uint64_t offset);
+
+	// 在中央目录之后追加结束记录，条目数、位置或尺寸超出范围时先写ZIP64结束记录和定位器
+	static void appendEnd(std::string &out, zip_uint64_t count, zip_uint64_t directoryOffset, zip_uint64_t directorySize,
+		const std::string &comment);
+
+private:
+	std::vector<CZipDirectoryEntry> entries;
+	zip_uint64_t directoryOffset;
+	zip_uint64_t directorySize;
+	std::string comment;
+
+	bool readEntries(const unsigned char *data, size_t length, zip_uint64_t count);
+};
+
+#endif
@@ -0,0 +1,148 @@
+#include "stdafx.h"
+#include <map>
+#include <zlib.h>
+#include "ZipDuplicateFinder.h"
+
+using namespace std;
+
+#define FINDER_CHUNK_SIZE	(1024 * 1024)
+
+namespace
+{
+	bool ReadChunk(HANDLE hFile, char *data, DWORD length, DWORD &count)
+	{
+		count = 0;
+		while (count < length)
+		{
+			DWORD dwRead = 0;
+			if (!ReadFile(hFile, data + count, length - count, &dwRead, NULL))
+				return false;
+			if (dwRead == 0)
+				break;
+
+			count += dwRead;
+		}
+		return true;
+	}
+}
+
+size_t CZipDuplicateFinder::find(const vector<CZipFolderScanner::File> &files, vector<size_t> &original) const
+{
+	original.resize(files.size());
+	for (size_t i = 0; i < files.size(); ++i)
+		original[i] = i;
+
+	// only files sharing their size with another file are read
+	map<zip_uint64_t, vector<size_t> > sizes;
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		if (files[i].size >= minSize)
+			sizes[files[i].size].push_back(i);
+	}
+
+	size_t duplicated = 0;
+	vector<bool> copied(files.size());
+	map<zip_uint64_t, vector<size_t> >::const_iterator it;
+	for (it = sizes.begin(); it != sizes.end(); ++it)
+	{
+		const vector<size_t> &group = it->second;
+		if (group.size() < 2)
+			continue;
+
+		// files with the same crc, each compared with the first files of distinct content
+		map<zip_uint32_t, vector<size_t> > candidates;
+		for (size_t i = 0; i < group.size(); ++i)
+		{
+			const CZipFolderScanner::File &file = files[group[i]];
+			zip_uint32_t crc;
+			if (!checksum(file.fileName, file.size, crc))
+				continue;
+
+			vector<size_t> &firsts = candidates[crc];
+			vector<size_t>::const_iterator first;
+			for (first = firsts.begin(); first != firsts.end(); ++first)
+			{
+				if (compare(files[*first].fileName, file.fileName))
+					break;
+			}
+
+			if (first == firsts.end())
+			{
+				firsts.push_back(group[i]);
+				continue;
+			}
+
+			if (!copied[*first])
+			{
+				copied[*first] = true;
+				++duplicated;
+			}
+			original[group[i]] = *first;
+		}
+	}
+
+	return duplicated;
+}
+
+bool CZipDuplicateFinder::checksum(const string &fileName, zip_uint64_t size, zip_uint32_t &crc)
+{
+	HANDLE hFile = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	vector<char> buffer(FINDER_CHUNK_SIZE);
+	uLong value = crc32(0L, Z_NULL, 0);
+	zip_uint64_t total = 0;
+	DWORD count;
+	bool result = true;
+	do
+	{
+		if (!ReadChunk(hFile, &buffer[0], FINDER_CHUNK_SIZE, count))
+		{
+			result = false;
+			break;
+		}
+
+		value = crc32(value, (const Bytef *)&buffer[0], count);
+		total += count;
+	} while (count == FINDER_CHUNK_SIZE);
+
+	CloseHandle(hFile);
+
+	// a file changed since the scan is not deduplicated
+	crc = (zip_uint32_t)value;
+	return result && total == size;
+}
+
+bool CZipDuplicateFinder::compare(const string &fileName1, const string &fileName2)
+{
+	HANDLE hFile1 = CreateFileA(fileName1.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile1 == INVALID_HANDLE_VALUE)
+		return false;
+
+	HANDLE hFile2 = CreateFileA(fileName2.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile2 == INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(hFile1);
+		return false;
+	}
+
+	vector<char> buffer1(FINDER_CHUNK_SIZE);
+	vector<char> buffer2(FINDER_CHUNK_SIZE);
+	bool same = true;
+	DWORD count1, count2;
+	do
+	{
+		if (!ReadChunk(hFile1, &buffer1[0], FINDER_CHUNK_SIZE, count1) ||
+			!ReadChunk(hFile2, &buffer2[0], FINDER_CHUNK_SIZE, count2) ||
+			count1 != count2 || memcmp(&buffer1[0], &buffer2[0], count1) != 0)
+		{
+			same = false;
+			break;
+		}
+	} while (count1 == FINDER_CHUNK_SIZE);
+
+	CloseHandle(hFile2);
+	CloseHandle(hFile1);
+	return same;
+}
@@ -0,0 +1,34 @@
+#ifndef ZIPDUPLICATEFINDER_H
+#define	ZIPDUPLICATEFINDER_H
+
+#include <string>
+#include <vector>
+
+#include <zipconf.h>
+#include "ZipFolderScanner.h"
+
+/*
+ * 找出内容相同的文件
+ * 先按尺寸分组，尺寸相同的文件再计算crc32，crc32也相同时逐字节比较确认，
+ * 只读取尺寸与其他文件相同的文件
+ */
+class CZipDuplicateFinder
+{
+public:
+	// 小于minSize的文件不比较
+	CZipDuplicateFinder(zip_uint64_t minSize = 1) : minSize(minSize) {}
+
+	/*
+	 * original[i]为与files[i]内容相同的第一个文件的序号，没有相同文件时为i
+	 * 返回有重复的内容数量，读取文件失败的文件按没有重复处理
+	 */
+	size_t find(const std::vector<CZipFolderScanner::File> &files, std::vector<size_t> &original) const;
+
+private:
+	zip_uint64_t minSize;
+
+	static bool checksum(const std::string &fileName, zip_uint64_t size, zip_uint32_t &crc);
+	static bool compare(const std::string &fileName1, const std::string &fileName2);
+};
+
+#endif
@@ -0,0 +1,143 @@
+#include "stdafx.h"
+#include "ZipEntryCache.h"
+
+using namespace std;
+
+CZipEntryCache::CZipEntryCache(size_t capacity /*= 64 * 1024 * 1024*/) : capacity(capacity), size(0), hits(0), misses(0)
+{
+	InitializeCriticalSection(&lock);
+}
+
+CZipEntryCache::~CZipEntryCache(void)
+{
+	DeleteCriticalSection(&lock);
+}
+
+CZipEntryCache::Buffer CZipEntryCache::find(zip_uint64_t archive, zip_uint64_t generation, zip_uint64_t index)
+{
+	Key key = { archive, generation, index };
+
+	EnterCriticalSection(&lock);
+	unordered_map<Key, ItemList::iterator, KeyHash>::iterator it = this->index.find(key);
+	if (it == this->index.end())
+	{
+		++misses;
+		LeaveCriticalSection(&lock);
+		return Buffer();
+	}
+
+	// move to the front of the LRU list
+	items.splice(items.begin(), items, it->second);
+	Buffer data = it->second->data;
+	++hits;
+	LeaveCriticalSection(&lock);
+
+	return data;
+}
+
+CZipEntryCache::Buffer CZipEntryCache::insert(zip_uint64_t archive, zip_uint64_t generation, zip_uint64_t index, vector<char> &data)
+{
+	shared_ptr<vector<char> > content = make_shared<vector<char> >();
+	content->swap(data);
+	Buffer buffer = content;
+
+	size_t length = buffer->size();
+	Key key = { archive, generation, index };
+
+	EnterCriticalSection(&lock);
+	if (length <= capacity)
+	{
+		unordered_map<Key, ItemList::iterator, KeyHash>::iterator it = this->index.find(key);
+		if (it != this->index.end())
+		{
+			// another thread loaded the same entry first
+			buffer = it->second->data;
+			items.splice(items.begin(), items, it->second);
+		}
+		else
+		{
+			evict(capacity - length);
+
+			Item item = { key, buffer };
+			items.push_front(item);
+			this->index[key] = items.begin();
+			size += length;
+		}
+	}
+	LeaveCriticalSection(&lock);
+
+	return buffer;
+}
+
+void CZipEntryCache::erase(zip_uint64_t archive)
+{
+	EnterCriticalSection(&lock);
+	ItemList::iterator it = items.begin();
+	while (it != items.end())
+	{
+		if (it->key.archive == archive)
+		{
+			size -= it->data->size();
+			index.erase(it->key);
+			it = items.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+	LeaveCriticalSection(&lock);
+}
+
+void CZipEntryCache::clear(void)
+{
+	EnterCriticalSection(&lock);
+	items.clear();
+	index.clear();
+	size = 0;
+	LeaveCriticalSection(&lock);
+}
+
+void CZipEntryCache::setCapacity(size_t capacity)
+{
+	EnterCriticalSection(&lock);
+	this->capacity = capacity;
+	evict(capacity);
+	LeaveCriticalSection(&lock);
+}
+
+size_t CZipEntryCache::getSize(void) const
+{
+	EnterCriticalSection(&lock);
+	size_t result = size;
+	LeaveCriticalSection(&lock);
+	return result;
+}
+
+size_t CZipEntryCache::getCount(void) const
+{
+	EnterCriticalSection(&lock);
+	size_t result = items.size();
+	LeaveCriticalSection(&lock);
+	return result;
+}
+
+void CZipEntryCache::resetCounters(void)
+{
+	EnterCriticalSection(&lock);
+	hits = 0;
+	misses = 0;
+	LeaveCriticalSection(&lock);
+}
+
+void CZipEntryCache::evict(size_t limit)
+{
+	// drop least recently used items until the cached bytes fit in limit
+	while (size > limit && !items.empty())
+	{
+		Item &item = items.back();
+		size -= item.data->size();
+		index.erase(item.key);
+		items.pop_back();
+	}
+}
@@ -0,0 +1,106 @@
+#ifndef ZIPENTRYCACHE_H
+#define	ZIPENTRYCACHE_H
+
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <Windows.h>
+
+#include <zipconf.h>
+
+/*
+ * 解压后条目内容的缓存，按字节预算做LRU淘汰
+ * 缓存的内容以只读共享缓冲区返回，淘汰后仍在使用的缓冲区不会被释放，
+ * 可以由多个CZipArchive共用，所有方法都是线程安全的
+ */
+class CZipEntryCache
+{
+public:
+	typedef std::shared_ptr<const std::vector<char> > Buffer;
+
+	// capacity为缓存内容的字节预算
+	CZipEntryCache(size_t capacity = 64 * 1024 * 1024);
+	virtual ~CZipEntryCache(void);
+
+	// 查找缓存，没有时返回空指针
+	Buffer find(zip_uint64_t archive, zip_uint64_t generation, zip_uint64_t index);
+
+	// 加入缓存，data的内容被取走，超过预算的内容不缓存但仍然返回
+	Buffer insert(zip_uint64_t archive, zip_uint64_t generation, zip_uint64_t index, std::vector<char> &data);
+
+	// 删除一个存档的所有缓存
+	void erase(zip_uint64_t archive);
+
+	void clear(void);
+
+	void setCapacity(size_t capacity);
+	size_t getCapacity(void) const
+	{
+		return capacity;
+	}
+
+	// 已缓存的字节数和条目数
+	size_t getSize(void) const;
+	size_t getCount(void) const;
+
+	// 命中和未命中次数
+	zip_uint64_t getHits(void) const
+	{
+		return hits;
+	}
+
+	zip_uint64_t getMisses(void) const
+	{
+		return misses;
+	}
+
+	void resetCounters(void);
+
+private:
+	struct Key
+	{
+		zip_uint64_t archive;
+		zip_uint64_t generation;
+		zip_uint64_t index;
+
+		bool operator==(const Key &other) const
+		{
+			return archive == other.archive && generation == other.generation && index == other.index;
+		}
+	};
+
+	struct KeyHash
+	{
+		size_t operator()(const Key &key) const
+		{
+			zip_uint64_t h = key.archive * 0x9E3779B97F4A7C15ULL;
+			h ^= key.generation + 0x632BE59BD9B4E019ULL + (h << 6) + (h >> 2);
+			h ^= key.index + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+			return (size_t)h;
+		}
+	};
+
+	struct Item
+	{
+		Key key;
+		Buffer data;
+	};
+
+	typedef std::list<Item> ItemList;
+
+	mutable CRITICAL_SECTION lock;
+	size_t capacity;
+	size_t size;
+	ItemList items;    // most recently used first
+	std::unordered_map<Key, ItemList::iterator, KeyHash> index;
+	zip_uint64_t hits;
+	zip_uint64_t misses;
+
+	void evict(size_t limit);
+
+	CZipEntryCache(const CZipEntryCache &);
+	CZipEntryCache &operator=(const CZipEntryCache &);
+};
+
+#endif
@@ -0,0 +1,284 @@
+#include "stdafx.h"
+#include <algorithm>
+#include "ZipEntryFilter.h"
+#include "UnicodeConv.h"
+
+using namespace std;
+
+CZipEntryFilter::CZipEntryFilter(void) : predicate(NULL), userData(NULL), compiled(false), compiledUtf8(false)
+{
+
+}
+
+void CZipEntryFilter::addPattern(const std::string &pattern)
+{
+	patterns.push_back(pattern);
+	compiled = false;
+}
+
+void CZipEntryFilter::addPrefix(const std::string &prefix)
+{
+	prefixes.push_back(prefix);
+	compiled = false;
+}
+
+void CZipEntryFilter::setPredicate(Predicate predicate, void *userData)
+{
+	this->predicate = predicate;
+	this->userData = userData;
+}
+
+bool CZipEntryFilter::isLiteral(void) const
+{
+	if (patterns.empty() || !prefixes.empty())
+		return false;
+
+	return literals.size() == patterns.size();
+}
+
+void CZipEntryFilter::compile(bool isUtf8) const
+{
+	if (compiled && compiledUtf8 == isUtf8)
+		return;
+
+	programs.clear();
+	charSets.clear();
+	literals.clear();
+	rawPrefixes.clear();
+
+	vector<string>::const_iterator it;
+	for (it = patterns.begin(); it != patterns.end(); ++it)
+		compilePattern(isUtf8 ? ConvertMultiBytesToUtf8(*it) : *it);
+
+	for (it = prefixes.begin(); it != prefixes.end(); ++it)
+		rawPrefixes.push_back(isUtf8 ? ConvertMultiBytesToUtf8(*it) : *it);
+
+	compiled = true;
+	compiledUtf8 = isUtf8;
+}
+
+void CZipEntryFilter::compilePattern(const std::string &pattern) const
+{
+	Program program;
+	bool literal = true;
+	string::size_type i = 0;
+	while (i < pattern.size())
+	{
+		unsigned char c = pattern[i];
+		Token token;
+		token.ch = 0;
+		token.set = -1;
+
+		if (c == '*')
+		{
+			literal = false;
+			if (i + 1 < pattern.size() && pattern[i + 1] == '*')
+			{
+				// "**/" matches zero or more directory levels, "**" anything
+				if (i + 2 < pattern.size() && pattern[i + 2] == '/')
+				{
+					token.type = TOKEN_DIRSTAR;
+					i += 3;
+				}
+				else
+				{
+					token.type = TOKEN_GLOBSTAR;
+					i += 2;
+				}
+			}
+			else
+			{
+				token.type = TOKEN_STAR;
+				++i;
+			}
+
+			// collapse repeated stars
+			if (!program.tokens.empty() && program.tokens.back().type == token.type && token.type != TOKEN_DIRSTAR)
+				continue;
+		}
+		else if (c == '?')
+		{
+			literal = false;
+			token.type = TOKEN_ANY;
+			++i;
+		}
+		else if (c == '[' && pattern.find(']', i + 2) != string::npos)
+		{
+			literal = false;
+			vector<bool> set(256, false);
+			string::size_type j = i + 1;
+			bool negate = false;
+			if (pattern[j] == '!' || pattern[j] == '^')
+			{
+				negate = true;
+				++j;
+			}
+
+			// a ']' right after the opening bracket is a member of the set
+			bool first = true;
+			while (j < pattern.size() && (first || pattern[j] != ']'))
+			{
+				unsigned char from = pattern[j];
+				unsigned char to = from;
+				if (j + 2 < pattern.size() && pattern[j + 1] == '-' && pattern[j + 2] != ']')
+				{
+					to = pattern[j + 2];
+					j += 3;
+				}
+				else
+				{
+					++j;
+				}
+
+				for (unsigned int k = from; k <= to; ++k)
+					set[k] = true;
+				first = false;
+			}
+
+			if (negate)
+			{
+				for (unsigned int k = 0; k < set.size(); ++k)
+					set[k] = !set[k];
+			}
+			set['/'] = false;
+
+			token.type = TOKEN_SET;
+			token.set = (int)charSets.size();
+			charSets.push_back(set);
+			i = j + 1;
+		}
+		else
+		{
+			if (c == '\\' && i + 1 < pattern.size())
+			{
+				literal = false;
+				c = pattern[++i];
+			}
+
+			token.type = TOKEN_CHAR;
+			token.ch = c;
+			if (program.tokens.empty() || (program.tokens.size() == program.literalPrefix.size()))
+				program.literalPrefix.push_back(c);
+			++i;
+		}
+
+		program.tokens.push_back(token);
+	}
+
+	if (literal)
+		literals.push_back(pattern);
+
+	programs.push_back(program);
+}
+
+void CZipEntryFilter::closure(const Program &program, std::vector<char> &active) const
+{
+	for (size_t i = 0; i < program.tokens.size(); ++i)
+	{
+		if (!active[i])
+			continue;
+
+		// "**/" may only be skipped when it is entered, not after it consumed characters
+		TokenType type = program.tokens[i].type;
+		if (type == TOKEN_STAR || type == TOKEN_GLOBSTAR || (type == TOKEN_DIRSTAR && (active[i] & 1) != 0))
+			active[i + 1] |= 1;
+	}
+}
+
+bool CZipEntryFilter::run(const Program &program, const char *name) const
+{
+	const vector<Token> &tokens = program.tokens;
+	size_t count = tokens.size();
+
+	const string &prefix = program.literalPrefix;
+	if (strncmp(name, prefix.c_str(), prefix.size()) != 0)
+		return false;
+
+	states.assign(count + 1, 0);
+	nextStates.assign(count + 1, 0);
+	states[0] = 1;
+	closure(program, states);
+
+	for (const char *p = name; *p != '\0'; ++p)
+	{
+		unsigned char c = *p;
+		bool any = false;
+		std::fill(nextStates.begin(), nextStates.end(), 0);
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (!states[i])
+				continue;
+
+			const Token &token = tokens[i];
+			switch (token.type)
+			{
+			case TOKEN_CHAR:
+				if (c == token.ch)
+					nextStates[i + 1] |= 1;
+				break;
+			case TOKEN_ANY:
+				if (c != '/')
+					nextStates[i + 1] |= 1;
+				break;
+			case TOKEN_SET:
+				if (charSets[token.set][c])
+					nextStates[i + 1] |= 1;
+				break;
+			case TOKEN_STAR:
+				if (c != '/')
+					nextStates[i] |= 1;
+				break;
+			case TOKEN_GLOBSTAR:
+				nextStates[i] |= 1;
+				break;
+			case TOKEN_DIRSTAR:
+				nextStates[i] |= 2;
+				if (c == '/')
+					nextStates[i + 1] |= 1;
+				break;
+			}
+		}
+
+		closure(program, nextStates);
+		for (size_t i = 0; i <= count && !any; ++i)
+			any = nextStates[i] != 0;
+
+		if (!any)
+			return false;
+
+		states.swap(nextStates);
+	}
+
+	return states[count] != 0;
+}
+
+bool CZipEntryFilter::matchName(const char *name) const
+{
+	if (patterns.empty() && prefixes.empty())
+		return true;
+
+	vector<string>::const_iterator pit;
+	for (pit = rawPrefixes.begin(); pit != rawPrefixes.end(); ++pit)
+	{
+		if (strncmp(name, pit->c_str(), pit->size()) == 0)
+			return true;
+	}
+
+	vector<Program>::const_iterator it;
+	for (it = programs.begin(); it != programs.end(); ++it)
+	{
+		if (run(*it, name))
+			return true;
+	}
+
+	return false;
+}
+
+bool CZipEntryFilter::match(const CZipEntryView &entry) const
+{
+	if (!matchName(entry.name))
+		return false;
+
+	return acceptView(entry);
+}
@@ -0,0 +1,121 @@
+#ifndef ZIPENTRYFILTER_H
+#define	ZIPENTRYFILTER_H
+
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include <zipconf.h>
+
+/*
+ * 条目的轻量视图，name指向libzip内部的条目名(未经Utf8ToAscii转换)，
+ * 过滤时不会为每个条目分配字符串
+ */
+struct CZipEntryView
+{
+	const char *name;
+	zip_uint64_t index;
+	zip_uint64_t size;
+	zip_uint64_t sizeComp;
+	time_t time;
+	int method;
+
+	bool isDirectory(void) const
+	{
+		size_t length = strlen(name);
+		return length > 0 && name[length - 1] == '/';
+	}
+};
+
+/*
+ * 条目过滤器
+ * 模式和前缀之间为"或"关系，判断函数与它们为"与"关系，空过滤器匹配所有条目
+ * 模式只编译一次，匹配时对所有状态同时推进，不会回溯
+ */
+class CZipEntryFilter
+{
+public:
+	typedef bool (*Predicate)(const CZipEntryView &entry, void *userData);
+
+	CZipEntryFilter(void);
+
+	// 添加通配符模式
+	// ? 匹配除'/'外的单个字符，* 匹配不含'/'的任意字符串，
+	// ** 匹配任意字符串，"**/" 匹配任意层级目录(包括零层)，
+	// [abc] [a-z] [!a] 字符集
+	void addPattern(const std::string &pattern);
+
+	// 添加路径前缀，如 "data/images/"
+	void addPrefix(const std::string &prefix);
+
+	// 设置判断函数，在分配条目名之前调用
+	void setPredicate(Predicate predicate, void *userData = NULL);
+
+	bool isEmpty(void) const
+	{
+		return patterns.empty() && prefixes.empty() && predicate == NULL;
+	}
+
+	// 按zip中的编码编译过滤器，由CZipArchive在使用前调用
+	void compile(bool isUtf8) const;
+
+	// 是否只包含不带通配符的模式(可直接按名称定位)
+	bool isLiteral(void) const;
+
+	// 返回不带通配符的模式(zip中的编码)，需先compile
+	const std::vector<std::string> &getLiterals(void) const
+	{
+		return literals;
+	}
+
+	bool match(const CZipEntryView &entry) const;
+	bool matchName(const char *name) const;
+
+	bool hasPredicate(void) const
+	{
+		return predicate != NULL;
+	}
+
+	// 只判断predicate
+	bool acceptView(const CZipEntryView &entry) const
+	{
+		return predicate == NULL || predicate(entry, userData);
+	}
+
+private:
+	enum TokenType { TOKEN_CHAR, TOKEN_ANY, TOKEN_SET, TOKEN_STAR, TOKEN_GLOBSTAR, TOKEN_DIRSTAR };
+
+	struct Token
+	{
+		TokenType type;
+		unsigned char ch;
+		int set;    // index into charSets
+	};
+
+	struct Program
+	{
+		std::string literalPrefix;
+		std::vector<Token> tokens;
+	};
+
+	std::vector<std::string> patterns;
+	std::vector<std::string> prefixes;
+	Predicate predicate;
+	void *userData;
+
+	mutable bool compiled;
+	mutable bool compiledUtf8;
+	mutable std::vector<Program> programs;
+	mutable std::vector<std::vector<bool> > charSets;
+	mutable std::vector<std::string> literals;
+	mutable std::vector<std::string> rawPrefixes;
+	mutable std::vector<char> states;
+	mutable std::vector<char> nextStates;
+
+	void compilePattern(const std::string &pattern) const;
+	bool run(const Program &program, const char *name) const;
+	void closure(const Program &program, std::vector<char> &active) const;
+};
+
+#endif
@@ -0,0 +1,371 @@
+#include "stdafx.h"
+#include <zlib.h>
+#include "ZipEntryIndex.h"
+#include "ZipFormat.h"
+
+using namespace std;
+
+#define INDEX_WINDOW_SIZE	32768
+#define INDEX_CHUNK_SIZE	65536
+#define INDEX_MAGIC			0x5844495A    // "ZIDX"
+#define INDEX_VERSION		1
+
+namespace
+{
+	bool ReadFully(CZipInputStream &input, void *data, size_t length)
+	{
+		char *bytes = (char *)data;
+		while (length > 0)
+		{
+			zip_int64_t count = input.read(bytes, length);
+			if (count <= 0)
+				return false;
+
+			bytes += count;
+			length -= (size_t)count;
+		}
+		return true;
+	}
+}
+
+void CZipEntryIndex::clear(void)
+{
+	points.clear();
+	size = 0;
+	sizeComp = 0;
+	crc = 0;
+	span = 0;
+}
+
+void CZipEntryIndex::addPoint(int bits, zip_uint64_t in, zip_uint64_t out, const unsigned char *window, size_t windowSize, size_t left)
+{
+	Point point;
+	point.out = out;
+	point.in = in;
+	point.bits = bits;
+
+	// the window is circular, the next byte would be written at windowSize - left
+	size_t count = out < windowSize ? (size_t)out : windowSize;
+	if (count > 0)
+	{
+		size_t end = (windowSize - left) % windowSize;
+		size_t start = (end + windowSize - count) % windowSize;
+		point.window.resize(count);
+		if (start < end)
+		{
+			memcpy(&point.window[0], window + start, count);
+		}
+		else
+		{
+			memcpy(&point.window[0], window + start, windowSize - start);
+			if (end > 0)
+				memcpy(&point.window[windowSize - start], window, end);
+		}
+	}
+
+	points.push_back(point);
+}
+
+bool CZipEntryIndex::build(CZipRandomInput &input, zip_uint64_t dataOffset, zip_uint64_t sizeComp, zip_uint64_t size, zip_uint32_t crc,
+	zip_uint64_t span /*= 4 * 1024 * 1024*/)
+{
+	clear();
+
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+		return false;
+
+	vector<unsigned char> buffer(INDEX_CHUNK_SIZE);
+	vector<unsigned char> window(INDEX_WINDOW_SIZE);
+	zip_uint64_t position = 0;
+	zip_uint64_t totalIn = 0;
+	zip_uint64_t totalOut = 0;
+	zip_uint64_t last = 0;
+	uLong entryCrc = crc32(0L, Z_NULL, 0);
+	int result = Z_OK;
+
+	// reads from the start of the entry need no window
+	addPoint(0, 0, 0, NULL, INDEX_WINDOW_SIZE, 0);
+
+	do
+	{
+		if (stream.avail_in == 0)
+		{
+			// with all input consumed inflate needs one more call to finish the last block,
+			// a call that makes no progress means the data is truncated
+			zip_uint64_t remaining = sizeComp - position;
+			if (remaining == 0 && result == Z_BUF_ERROR)
+			{
+				result = Z_DATA_ERROR;
+				break;
+			}
+
+			size_t count = remaining < INDEX_CHUNK_SIZE ? (size_t)remaining : INDEX_CHUNK_SIZE;
+			if (count > 0 && !input.readAt(dataOffset + position, &buffer[0], count))
+			{
+				result = Z_ERRNO;
+				break;
+			}
+
+			position += count;
+			stream.next_in = &buffer[0];
+			stream.avail_in = (uInt)count;
+		}
+
+		do
+		{
+			if (stream.avail_out == 0)
+			{
+				stream.next_out = &window[0];
+				stream.avail_out = INDEX_WINDOW_SIZE;
+			}
+
+			// Z_BLOCK stops at every deflate block boundary
+			Bytef *outStart = stream.next_out;
+			totalIn += stream.avail_in;
+			totalOut += stream.avail_out;
+			result = inflate(&stream, Z_BLOCK);
+			totalIn -= stream.avail_in;
+			totalOut -= stream.avail_out;
+			entryCrc = crc32(entryCrc, outStart, (uInt)(stream.next_out - outStart));
+
+			if (result == Z_NEED_DICT)
+				result = Z_DATA_ERROR;
+			if (result != Z_OK && result != Z_BUF_ERROR)
+				break;
+
+			// bit 128: end of a block header, bit 64: last block
+			if ((stream.data_type & 128) && !(stream.data_type & 64) && totalOut - last > span)
+			{
+				addPoint(stream.data_type & 7, totalIn, totalOut, &window[0], INDEX_WINDOW_SIZE, stream.avail_out);
+				last = totalOut;
+			}
+		} while (stream.avail_in != 0);
+	} while (result == Z_OK || result == Z_BUF_ERROR);
+
+	inflateEnd(&stream);
+
+	if (result != Z_STREAM_END || totalOut != size || entryCrc != crc)
+	{
+		points.clear();
+		return false;
+	}
+
+	this->size = size;
+	this->sizeComp = sizeComp;
+	this->crc = crc;
+	this->span = span;
+	return true;
+}
+
+zip_int64_t CZipEntryIndex::read(CZipRandomInput &input, zip_uint64_t dataOffset, zip_uint64_t offset, void *data, size_t length) const
+{
+	if (points.empty())
+		return -1;
+
+	if (offset >= size || length == 0)
+		return 0;
+
+	if (length > size - offset)
+		length = (size_t)(size - offset);
+
+	// last checkpoint at or before offset
+	size_t low = 0;
+	size_t high = points.size();
+	while (high - low > 1)
+	{
+		size_t middle = (low + high) / 2;
+		if (points[middle].out <= offset)
+			low = middle;
+		else
+			high = middle;
+	}
+	const Point &point = points[low];
+
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+		return -1;
+
+	bool failed = false;
+	if (point.bits > 0)
+	{
+		// the checkpoint starts inside the byte before 'in'
+		unsigned char byte;
+		if (!input.readAt(dataOffset + point.in - 1, &byte, 1))
+			failed = true;
+		else
+			inflatePrime(&stream, point.bits, byte >> (8 - point.bits));
+	}
+
+	if (!failed && !point.window.empty())
+		inflateSetDictionary(&stream, &point.window[0], (uInt)point.window.size());
+
+	vector<unsigned char> buffer(INDEX_CHUNK_SIZE);
+	vector<unsigned char> discard;
+	zip_uint64_t position = point.in;
+	zip_uint64_t skip = offset - point.out;
+	unsigned char *out = (unsigned char *)data;
+	size_t produced = 0;
+
+	while (!failed && produced < length)
+	{
+		if (stream.avail_in == 0)
+		{
+			zip_uint64_t remaining = sizeComp - position;
+			size_t count = remaining < INDEX_CHUNK_SIZE ? (size_t)remaining : INDEX_CHUNK_SIZE;
+			if (count == 0 || !input.readAt(dataOffset + position, &buffer[0], count))
+			{
+				failed = true;
+				break;
+			}
+
+			position += count;
+			stream.next_in = &buffer[0];
+			stream.avail_in = (uInt)count;
+		}
+
+		uInt available;
+		if (skip > 0)
+		{
+			// inflate and drop the data between the checkpoint and offset
+			if (discard.empty())
+				discard.resize(INDEX_CHUNK_SIZE);
+			available = skip < INDEX_CHUNK_SIZE ? (uInt)skip : INDEX_CHUNK_SIZE;
+			stream.next_out = &discard[0];
+		}
+		else
+		{
+			size_t wanted = length - produced;
+			available = wanted < 0x40000000 ? (uInt)wanted : 0x40000000;
+			stream.next_out = out + produced;
+		}
+		stream.avail_out = available;
+
+		int result = inflate(&stream, Z_NO_FLUSH);
+		size_t count = available - stream.avail_out;
+		if (skip > 0)
+			skip -= count;
+		else
+			produced += count;
+
+		if (result == Z_STREAM_END)
+			break;
+		if (result != Z_OK && result != Z_BUF_ERROR)
+			failed = true;
+	}
+
+	inflateEnd(&stream);
+	return failed ? -1 : (zip_int64_t)produced;
+}
+
+bool CZipEntryIndex::save(CZipOutputStream &output) const
+{
+	if (points.empty())
+		return false;
+
+	string header;
+	ZipPut32(header, INDEX_MAGIC);
+	ZipPut32(header, INDEX_VERSION);
+	ZipPut64(header, span);
+	ZipPut64(header, size);
+	ZipPut64(header, sizeComp);
+	ZipPut32(header, crc);
+	ZipPut64(header, points.size());
+	if (!output.write(header.data(), header.size()))
+		return false;
+
+	vector<Point>::const_iterator it;
+	for (it = points.begin(); it != points.end(); ++it)
+	{
+		string record;
+		ZipPut64(record, it->out);
+		ZipPut64(record, it->in);
+		ZipPut16(record, (zip_uint16_t)it->bits);
+		ZipPut32(record, (zip_uint32_t)it->window.size());
+		if (!output.write(record.data(), record.size()))
+			return false;
+
+		if (!it->window.empty() && !output.write(&it->window[0], it->window.size()))
+			return false;
+	}
+
+	return output.flush();
+}
+
+bool CZipEntryIndex::save(const string &fileName) const
+{
+	HANDLE hFile = CreateFileA(fileName.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	CZipHandleOutputStream output(hFile);
+	bool result = save(output);
+	CloseHandle(hFile);
+
+	if (!result)
+		DeleteFileA(fileName.c_str());
+	return result;
+}
+
+bool CZipEntryIndex::load(CZipInputStream &input)
+{
+	clear();
+
+	unsigned char header[44];
+	if (!ReadFully(input, header, sizeof(header)))
+		return false;
+
+	if (ZipGet32(header) != INDEX_MAGIC || ZipGet32(header + 4) != INDEX_VERSION)
+		return false;
+
+	zip_uint64_t count = ZipGet64(header + 36);
+	vector<Point> loaded;
+	for (zip_uint64_t i = 0; i < count; ++i)
+	{
+		unsigned char record[22];
+		if (!ReadFully(input, record, sizeof(record)))
+			return false;
+
+		Point point;
+		point.out = ZipGet64(record);
+		point.in = ZipGet64(record + 8);
+		point.bits = ZipGet16(record + 16);
+		zip_uint32_t windowSize = ZipGet32(record + 18);
+		if (point.bits > 7 || windowSize > INDEX_WINDOW_SIZE)
+			return false;
+
+		point.window.resize(windowSize);
+		if (windowSize > 0 && !ReadFully(input, &point.window[0], windowSize))
+			return false;
+
+		// checkpoints must be in order for the binary search
+		if (!loaded.empty() && point.out <= loaded.back().out)
+			return false;
+
+		loaded.push_back(point);
+	}
+
+	if (loaded.empty() || loaded[0].out != 0)
+		return false;
+
+	points.swap(loaded);
+	span = ZipGet64(header + 8);
+	size = ZipGet64(header + 16);
+	sizeComp = ZipGet64(header + 24);
+	crc = ZipGet32(header + 32);
+	return true;
+}
+
+bool CZipEntryIndex::load(const string &fileName)
+{
+	HANDLE hFile = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	CZipHandleInputStream input(hFile);
+	bool result = load(input);
+	CloseHandle(hFile);
+	return result;
+}
@@ -0,0 +1,88 @@
+#ifndef ZIPENTRYINDEX_H
+#define	ZIPENTRYINDEX_H
+
+#include <string>
+#include <vector>
+
+#include <zipconf.h>
+#include "ZipStream.h"
+
+/*
+ * deflate条目的随机访问索引(参考zlib示例zran.c)
+ * 完整解压一次条目，每隔span字节在deflate块边界保存一个检查点(输入位置、输出位置和32K窗口)，
+ * 之后读取任意区间时从区间之前最近的检查点开始解压，最多多解压span字节
+ * 索引可以保存到文件，和存档一起分发或下次打开时加载
+ */
+class CZipEntryIndex
+{
+public:
+	CZipEntryIndex(void) : size(0), sizeComp(0), crc(0), span(0) {}
+
+	/*
+	 * 从input的dataOffset处的原始deflate数据建立索引
+	 * sizeComp、size和crc为中央目录中的值，解压结果不一致时失败
+	 */
+	bool build(CZipRandomInput &input, zip_uint64_t dataOffset, zip_uint64_t sizeComp, zip_uint64_t size, zip_uint32_t crc,
+		zip_uint64_t span = 4 * 1024 * 1024);
+
+	// 读取解压后[offset, offset + length)的内容，返回读取的字节数，出错时返回-1
+	zip_int64_t read(CZipRandomInput &input, zip_uint64_t dataOffset, zip_uint64_t offset, void *data, size_t length) const;
+
+	bool save(CZipOutputStream &output) const;
+	bool save(const std::string &fileName) const;
+	bool load(CZipInputStream &input);
+	bool load(const std::string &fileName);
+
+	void clear(void);
+
+	bool isEmpty(void) const
+	{
+		return points.empty();
+	}
+
+	// 检查点数量
+	size_t getCount(void) const
+	{
+		return points.size();
+	}
+
+	// 建立索引的条目信息，用于判断索引是否属于某个条目
+	zip_uint64_t getSize(void) const
+	{
+		return size;
+	}
+
+	zip_uint64_t getInflatedSize(void) const
+	{
+		return sizeComp;
+	}
+
+	zip_uint32_t getCRC(void) const
+	{
+		return crc;
+	}
+
+	zip_uint64_t getSpan(void) const
+	{
+		return span;
+	}
+
+private:
+	struct Point
+	{
+		zip_uint64_t out;                   // offset in the inflated data
+		zip_uint64_t in;                    // offset in the deflate data, of the first full byte
+		int bits;                           // bits of the byte before 'in' still to be used
+		std::vector<unsigned char> window;  // inflated data preceding 'out', at most 32K
+	};
+
+	std::vector<Point> points;
+	zip_uint64_t size;
+	zip_uint64_t sizeComp;
+	zip_uint32_t crc;
+	zip_uint64_t span;
+
+	void addPoint(int bits, zip_uint64_t in, zip_uint64_t out, const unsigned char *window, size_t windowSize, size_t left);
+};
+
+#endif
@@ -0,0 +1,264 @@
+#include "stdafx.h"
+#include <algorithm>
+#include <map>
+#include "ZipEntryOrder.h"
+#include "ZipDirectory.h"
+#include "ZipFormat.h"
+
+using namespace std;
+
+#define ORDER_COPY_SIZE		(1024 * 1024)
+
+namespace
+{
+	struct RankLess
+	{
+		const vector<size_t> &ranks;
+
+		RankLess(const vector<size_t> &ranks) : ranks(ranks) {}
+
+		bool operator()(size_t a, size_t b) const
+		{
+			return ranks[a] < ranks[b];
+		}
+	};
+
+	struct Folder
+	{
+		string path;
+		bool isFile;    // the folder entry itself comes before its contents
+	};
+
+	struct FolderLess
+	{
+		const vector<Folder> &folders;
+
+		FolderLess(const vector<Folder> &folders) : folders(folders) {}
+
+		bool operator()(size_t a, size_t b) const
+		{
+			int result = folders[a].path.compare(folders[b].path);
+			if (result != 0)
+				return result < 0;
+			return !folders[a].isFile && folders[b].isFile;
+		}
+	};
+
+	struct SizeLess
+	{
+		const vector<zip_uint64_t> &sizes;
+
+		SizeLess(const vector<zip_uint64_t> &sizes) : sizes(sizes) {}
+
+		bool operator()(size_t a, size_t b) const
+		{
+			return sizes[a] < sizes[b];
+		}
+	};
+
+	struct OffsetLess
+	{
+		const CZipDirectory &directory;
+
+		OffsetLess(const CZipDirectory &directory) : directory(directory) {}
+
+		bool operator()(size_t a, size_t b) const
+		{
+			return directory.getEntry(a).offset < directory.getEntry(b).offset;
+		}
+	};
+
+	Folder GetFolder(const string &name)
+	{
+		Folder folder;
+		folder.isFile = true;
+		folder.path = name;
+		if (!name.empty() && (name[name.size() - 1] == '/' || name[name.size() - 1] == '\\'))
+		{
+			folder.isFile = false;
+			folder.path.erase(name.size() - 1);
+			return folder;
+		}
+
+		size_t pos = name.find_last_of("/\\");
+		folder.path.erase(pos == string::npos ? 0 : pos);
+		return folder;
+	}
+
+	bool CopyRange(CZipRandomInput &input, zip_uint64_t offset, zip_uint64_t length, CZipOutputStream &output, vector<char> &buffer)
+	{
+		while (length > 0)
+		{
+			size_t count = length < buffer.size() ? (size_t)length : buffer.size();
+			if (!input.readAt(offset, &buffer[0], count) || !output.write(&buffer[0], count))
+				return false;
+
+			offset += count;
+			length -= count;
+		}
+		return true;
+	}
+}
+
+bool CZipEntryOrder::loadProfile(const string &fileName)
+{
+	HANDLE hFile = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	string content;
+	char data[64 * 1024];
+	CZipHandleInputStream input(hFile);
+	zip_int64_t result;
+	while ((result = input.read(data, sizeof(data))) > 0)
+		content.append(data, (size_t)result);
+	CloseHandle(hFile);
+	if (result < 0)
+		return false;
+
+	profile.clear();
+	size_t start = 0;
+	while (start < content.size())
+	{
+		size_t end = content.find('\n', start);
+		if (end == string::npos)
+			end = content.size();
+
+		string name = content.substr(start, end - start);
+		if (!name.empty() && name[name.size() - 1] == '\r')
+			name.erase(name.size() - 1);
+		if (!name.empty())
+			profile.push_back(name);
+		start = end + 1;
+	}
+	return true;
+}
+
+void CZipEntryOrder::arrange(const vector<string> &names, const vector<zip_uint64_t> &sizes, vector<size_t> &order) const
+{
+	order.resize(names.size());
+	for (size_t i = 0; i < order.size(); ++i)
+		order[i] = i;
+
+	if (policy == PROFILE)
+	{
+		// the first occurrence of a name wins, unlisted entries keep their order after the listed ones
+		map<string, size_t> listed;
+		for (size_t i = 0; i < profile.size(); ++i)
+			listed.insert(make_pair(profile[i], i));
+
+		vector<size_t> ranks(names.size(), profile.size());
+		for (size_t i = 0; i < names.size(); ++i)
+		{
+			map<string, size_t>::const_iterator it = listed.find(names[i]);
+			if (it != listed.end())
+				ranks[i] = it->second;
+		}
+		stable_sort(order.begin(), order.end(), RankLess(ranks));
+	}
+	else if (policy == DIRECTORY)
+	{
+		vector<Folder> folders(names.size());
+		for (size_t i = 0; i < names.size(); ++i)
+			folders[i] = GetFolder(names[i]);
+		stable_sort(order.begin(), order.end(), FolderLess(folders));
+	}
+	else if (policy == SIZE && sizes.size() == names.size())
+	{
+		stable_sort(order.begin(), order.end(), SizeLess(sizes));
+	}
+}
+
+bool CZipEntryOrder::rewrite(CZipRandomInput &input, const vector<size_t> &order, CZipOutputStream &output)
+{
+	CZipDirectory directory;
+	if (!directory.read(input) || directory.getCount() != order.size())
+		return false;
+
+	size_t count = directory.getCount();
+	vector<bool> seen(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (order[i] >= count || seen[order[i]])
+			return false;
+		seen[order[i]] = true;
+	}
+
+	// every entry owns the bytes up to the next entry, data descriptor included
+	vector<size_t> byOffset(count);
+	for (size_t i = 0; i < count; ++i)
+		byOffset[i] = i;
+	sort(byOffset.begin(), byOffset.end(), OffsetLess(directory));
+
+	vector<zip_uint64_t> ends(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		zip_uint64_t end = i + 1 < count ? directory.getEntry(byOffset[i + 1]).offset : directory.getDirectoryOffset();
+		if (end <= directory.getEntry(byOffset[i]).offset)
+			return false;    //entries sharing data cannot be moved apart
+		ends[byOffset[i]] = end;
+	}
+
+	// data in front of the first entry, such as a self-extractor stub, stays where it is
+	vector<char> buffer(ORDER_COPY_SIZE);
+	zip_uint64_t position = count > 0 ? directory.getEntry(byOffset[0]).offset : directory.getDirectoryOffset();
+	if (!CopyRange(input, 0, position, output, buffer))
+		return false;
+
+	string central;
+	zip_uint64_t copyStart = 0;
+	zip_uint64_t copyEnd = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		const CZipDirectoryEntry &entry = directory.getEntry(order[i]);
+		string record = entry.record;
+		if (!CZipDirectory::setRecordOffset(record, position))
+			return false;
+		central.append(record);
+
+		// entries that stay neighbours are copied together
+		if (copyEnd != entry.offset)
+		{
+			if (!CopyRange(input, copyStart, copyEnd - copyStart, output, buffer))
+				return false;
+			copyStart = entry.offset;
+		}
+		copyEnd = ends[order[i]];
+		position += copyEnd - entry.offset;
+	}
+
+	if (!CopyRange(input, copyStart, copyEnd - copyStart, output, buffer))
+		return false;
+
+	zip_uint64_t directorySize = central.size();
+	CZipDirectory::appendEnd(central, count, position, directorySize, directory.getComment());
+	return output.write(central.data(), central.size()) && output.flush();
+}
+
+bool CZipEntryOrder::rewrite(const string &path, const vector<size_t> &order)
+{
+	HANDLE hFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	string tempPath = path + ".order";
+	HANDLE hTemp = CreateFileA(tempPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL);
+	if (hTemp == INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(hFile);
+		return false;
+	}
+
+	CZipHandleRandomInput input(hFile);
+	CZipHandleOutputStream output(hTemp);
+	bool result = rewrite(input, order, output) && FlushFileBuffers(hTemp);
+	CloseHandle(hTemp);
+	CloseHandle(hFile);
+
+	// the original stays intact until the new file is complete
+	if (result)
+		result = MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != FALSE;
+	if (!result)
+		DeleteFileA(tempPath.c_str());
+	return result;
+}
@@ -0,0 +1,72 @@
+#ifndef ZIPENTRYORDER_H
+#define	ZIPENTRYORDER_H
+
+#include <string>
+#include <vector>
+
+#include <zipconf.h>
+#include "ZipStream.h"
+
+/*
+ * 条目在存档文件中的排列策略
+ * 存档关闭时按策略重新排列条目的本地文件头和数据(原样复制，不重新压缩)，中央目录也按新顺序写入，
+ * 运行时按同样的顺序读取条目时基本是顺序读
+ */
+class CZipEntryOrder
+{
+public:
+	enum Policy
+	{
+		ORIGINAL,     // 保持libzip写入的顺序
+		PROFILE,      // 按名称列表的顺序，不在列表中的条目保持原顺序排在后面
+		DIRECTORY,    // 同一目录的条目放在一起，目录条目在其内容之前，目录按名称排序
+		SIZE          // 按解压后的尺寸从小到大
+	};
+
+	CZipEntryOrder(Policy policy = ORIGINAL) : policy(policy) {}
+
+	void setPolicy(Policy policy)
+	{
+		this->policy = policy;
+	}
+
+	Policy getPolicy(void) const
+	{
+		return policy;
+	}
+
+	// 设置PROFILE策略的名称列表，名称与CZipEntry::getName相同
+	void setProfile(const std::vector<std::string> &names)
+	{
+		profile = names;
+	}
+
+	const std::vector<std::string> &getProfile(void) const
+	{
+		return profile;
+	}
+
+	// 从文本文件加载名称列表，每行一个名称，忽略空行
+	bool loadProfile(const std::string &fileName);
+
+	/*
+	 * 计算新顺序，order[i]为排在第i位的条目
+	 * names和sizes按中央目录的顺序给出
+	 */
+	void arrange(const std::vector<std::string> &names, const std::vector<zip_uint64_t> &sizes, std::vector<size_t> &order) const;
+
+	/*
+	 * 把input中的存档按order的顺序写入output，order的下标与中央目录的顺序相同
+	 * 相邻且顺序不变的条目合并为一次复制
+	 */
+	static bool rewrite(CZipRandomInput &input, const std::vector<size_t> &order, CZipOutputStream &output);
+
+	// 在原文件上应用顺序，先写入临时文件(path + ".order")再替换原文件
+	static bool rewrite(const std::string &path, const std::vector<size_t> &order);
+
+private:
+	Policy policy;
+	std::vector<std::string> profile;
+};
+
+#endif
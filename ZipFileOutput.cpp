@@ -0,0 +1,299 @@
+#include "stdafx.h"
+#include "ZipFileOutput.h"
+#include "ZipArchive.h"
+
+using namespace std;
+
+#define OUTPUT_BUFFER_SIZE	65536
+#define OUTPUT_CHUNK_SIZE	(1024 * 1024)
+
+namespace
+{
+	bool WriteAll(HANDLE hFile, const char *data, size_t length)
+	{
+		CZipHandleOutputStream output(hFile);
+		return output.write(data, length);
+	}
+
+	// a file written on the calling thread
+	class SyncFile : public CZipOutputStream
+	{
+	public:
+		SyncFile(HANDLE hFile) : hFile(hFile), failed(false)
+		{
+			buffer.reserve(OUTPUT_BUFFER_SIZE);
+		}
+
+		virtual bool write(const void *data, size_t length)
+		{
+			if (buffer.size() + length > OUTPUT_BUFFER_SIZE)
+				flush();
+
+			if (length >= OUTPUT_BUFFER_SIZE)
+			{
+				if (!failed && !WriteAll(hFile, (const char *)data, length))
+					failed = true;
+			}
+			else
+			{
+				buffer.insert(buffer.end(), (const char *)data, (const char *)data + length);
+			}
+			return !failed;
+		}
+
+		virtual bool flush(void)
+		{
+			if (!buffer.empty() && !failed && !WriteAll(hFile, &buffer[0], buffer.size()))
+				failed = true;
+			buffer.clear();
+			return !failed;
+		}
+
+		HANDLE hFile;
+		std::string fileName;
+		bool failed;
+
+	private:
+		vector<char> buffer;
+	};
+}
+
+void CZipFileOutput::createFolder(const string &folderName)
+{
+	CZipArchive::createFolder(folderName);
+}
+
+CZipOutputStream *CZipSyncFileOutput::createFile(const string &fileName)
+{
+	HANDLE hFile = CreateFileA(fileName.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return NULL;
+
+	SyncFile *file = new SyncFile(hFile);
+	file->fileName = fileName;
+	return file;
+}
+
+bool CZipSyncFileOutput::closeFile(CZipOutputStream *file, time_t time, bool success)
+{
+	SyncFile *syncFile = (SyncFile *)file;
+	bool written = syncFile->flush();
+	if (success && written)
+	{
+		FILETIME ftUTC;
+		CZipArchive::TimetToFileTime(time, &ftUTC);
+		SetFileTime(syncFile->hFile, &ftUTC, &ftUTC, &ftUTC);
+	}
+
+	CloseHandle(syncFile->hFile);
+	if (!success || !written)
+		DeleteFileA(syncFile->fileName.c_str());
+
+	delete syncFile;
+	return written;
+}
+
+// buffers data until a chunk is full, the chunk is then written by the file's worker
+class CZipAsyncFileOutput::AsyncFile : public CZipOutputStream
+{
+public:
+	AsyncFile(CZipAsyncFileOutput *owner, const string &fileName, size_t worker) : owner(owner), fileName(fileName),
+		worker(worker), hFile(INVALID_HANDLE_VALUE), failed(false)
+	{
+
+	}
+
+	virtual bool write(const void *data, size_t length)
+	{
+		buffer.insert(buffer.end(), (const char *)data, (const char *)data + length);
+		if (buffer.size() >= OUTPUT_CHUNK_SIZE)
+			owner->submit(this, buffer, false, 0, true);
+		return true;
+	}
+
+	CZipAsyncFileOutput *owner;
+	string fileName;
+	size_t worker;
+	vector<char> buffer;
+
+	// used by the worker only
+	HANDLE hFile;
+	bool failed;
+};
+
+CZipAsyncFileOutput::CZipAsyncFileOutput(size_t threads /*= 4*/, size_t maxPending /*= 64 * 1024 * 1024*/) :
+nextWorker(0), maxPending(maxPending), pendingBytes(0), outstanding(0), stopping(false)
+{
+	InitializeCriticalSection(&lock);
+	InitializeConditionVariable(&ready);
+	InitializeConditionVariable(&done);
+
+	workers.resize(threads > 0 ? threads : 1);
+	for (size_t i = 0; i < workers.size(); ++i)
+		workers[i].owner = this;
+
+	// workers are started once the vector no longer moves
+	for (size_t i = 0; i < workers.size(); ++i)
+		workers[i].hThread = CreateThread(NULL, 0, ThreadProc, &workers[i], 0, NULL);
+}
+
+CZipAsyncFileOutput::~CZipAsyncFileOutput(void)
+{
+	finish();
+
+	EnterCriticalSection(&lock);
+	stopping = true;
+	WakeAllConditionVariable(&ready);
+	LeaveCriticalSection(&lock);
+
+	for (size_t i = 0; i < workers.size(); ++i)
+	{
+		if (workers[i].hThread != NULL)
+		{
+			WaitForSingleObject(workers[i].hThread, INFINITE);
+			CloseHandle(workers[i].hThread);
+		}
+	}
+
+	DeleteCriticalSection(&lock);
+}
+
+CZipOutputStream *CZipAsyncFileOutput::createFile(const string &fileName)
+{
+	// workers that failed to start get no files
+	for (size_t i = 0; i < workers.size(); ++i)
+	{
+		size_t worker = nextWorker++ % workers.size();
+		if (workers[worker].hThread != NULL)
+			return new AsyncFile(this, fileName, worker);
+	}
+	return NULL;
+}
+
+bool CZipAsyncFileOutput::closeFile(CZipOutputStream *file, time_t time, bool success)
+{
+	AsyncFile *asyncFile = (AsyncFile *)file;
+	submit(asyncFile, asyncFile->buffer, true, time, success);
+	return true;
+}
+
+size_t CZipAsyncFileOutput::finish(vector<string> *failedFiles)
+{
+	EnterCriticalSection(&lock);
+	while (outstanding > 0)
+		SleepConditionVariableCS(&done, &lock, INFINITE);
+
+	size_t result = this->failedFiles.size();
+	if (failedFiles != NULL)
+		failedFiles->insert(failedFiles->end(), this->failedFiles.begin(), this->failedFiles.end());
+	this->failedFiles.clear();
+	LeaveCriticalSection(&lock);
+	return result;
+}
+
+void CZipAsyncFileOutput::submit(AsyncFile *file, vector<char> &data, bool close, time_t time, bool success)
+{
+	size_t length = data.size();
+
+	EnterCriticalSection(&lock);
+
+	// bounded memory, the writer waits for the workers to catch up
+	while (pendingBytes > 0 && pendingBytes + length > maxPending)
+		SleepConditionVariableCS(&done, &lock, INFINITE);
+
+	Worker &worker = workers[file->worker];
+	worker.queue.push_back(Operation());
+	Operation &operation = worker.queue.back();
+	operation.file = file;
+	operation.data.swap(data);
+	operation.close = close;
+	operation.time = time;
+	operation.success = success;
+	pendingBytes += length;
+	++outstanding;
+	WakeAllConditionVariable(&ready);
+	LeaveCriticalSection(&lock);
+}
+
+DWORD WINAPI CZipAsyncFileOutput::ThreadProc(LPVOID param)
+{
+	Worker *worker = (Worker *)param;
+	worker->owner->work(*worker);
+	return 0;
+}
+
+void CZipAsyncFileOutput::work(Worker &worker)
+{
+	EnterCriticalSection(&lock);
+	for (;;)
+	{
+		while (worker.queue.empty() && !stopping)
+			SleepConditionVariableCS(&ready, &lock, INFINITE);
+		if (worker.queue.empty())
+			break;
+
+		Operation operation;
+		Operation &front = worker.queue.front();
+		operation.file = front.file;
+		operation.data.swap(front.data);
+		operation.close = front.close;
+		operation.time = front.time;
+		operation.success = front.success;
+		worker.queue.pop_front();
+		LeaveCriticalSection(&lock);
+
+		// run deletes the file on close, keep its name for the failure list
+		size_t length = operation.data.size();
+		string fileName;
+		if (operation.close)
+			fileName = operation.file->fileName;
+		bool result = run(operation);
+
+		EnterCriticalSection(&lock);
+		if (!result)
+			failedFiles.push_back(fileName);
+		pendingBytes -= length;
+		--outstanding;
+		WakeAllConditionVariable(&done);
+	}
+	LeaveCriticalSection(&lock);
+}
+
+bool CZipAsyncFileOutput::run(Operation &operation)
+{
+	AsyncFile *file = operation.file;
+
+	// the file is created with its first chunk, entries that failed to inflate never reach the disk
+	if (file->hFile == INVALID_HANDLE_VALUE && !file->failed && operation.success)
+	{
+		file->hFile = CreateFileA(file->fileName.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file->hFile == INVALID_HANDLE_VALUE)
+			file->failed = true;
+	}
+
+	if (!file->failed && operation.success && !operation.data.empty() &&
+		!WriteAll(file->hFile, &operation.data[0], operation.data.size()))
+		file->failed = true;
+
+	if (!operation.close)
+		return true;
+
+	if (file->hFile != INVALID_HANDLE_VALUE)
+	{
+		if (operation.success && !file->failed)
+		{
+			FILETIME ftUTC;
+			CZipArchive::TimetToFileTime(operation.time, &ftUTC);
+			SetFileTime(file->hFile, &ftUTC, &ftUTC, &ftUTC);
+		}
+
+		CloseHandle(file->hFile);
+		if (!operation.success || file->failed)
+			DeleteFileA(file->fileName.c_str());
+	}
+
+	// a rejected entry is not an output failure, the caller already knows about it
+	bool result = !operation.success || !file->failed;
+	delete file;
+	return result;
+}
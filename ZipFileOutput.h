@@ -0,0 +1,102 @@
+#ifndef ZIPFILEOUTPUT_H
+#define	ZIPFILEOUTPUT_H
+
+#include <ctime>
+#include <deque>
+#include <string>
+#include <vector>
+#include <Windows.h>
+
+#include <zipconf.h>
+#include "ZipStream.h"
+
+/*
+ * 解压时写文件的方式
+ * CZipArchive通过createFile得到输出流，写完后调用closeFile设置修改时间并关闭，
+ * 全部条目写完后调用finish等待未完成的文件
+ */
+class CZipFileOutput
+{
+public:
+	virtual ~CZipFileOutput(void) {}
+
+	// 创建目录(包括父目录)
+	virtual void createFolder(const std::string &folderName);
+
+	// 创建文件，失败时返回NULL，返回的流在closeFile之后失效
+	virtual CZipOutputStream *createFile(const std::string &fileName) = 0;
+
+	// 关闭文件并设置修改时间，success为false时删除文件，返回false表示文件写入失败
+	virtual bool closeFile(CZipOutputStream *file, time_t time, bool success) = 0;
+
+	// 等待所有文件写完，返回其间写入失败的文件数，failedFiles不为NULL时追加这些文件名
+	virtual size_t finish(std::vector<std::string> *failedFiles = NULL)
+	{
+		return 0;
+	}
+};
+
+// 在调用线程中直接写文件，数据攒到64K再调用WriteFile
+class CZipSyncFileOutput : public CZipFileOutput
+{
+public:
+	virtual CZipOutputStream *createFile(const std::string &fileName);
+	virtual bool closeFile(CZipOutputStream *file, time_t time, bool success);
+};
+
+/*
+ * 由后台线程创建、写入、设置时间和关闭文件，多个文件同时进行，调用线程继续解压
+ * 同一个文件的操作由同一个线程按顺序完成，排队的数据超过maxPending字节时写入方等待
+ * closeFile总是返回true，写入失败在finish中统计
+ */
+class CZipAsyncFileOutput : public CZipFileOutput
+{
+public:
+	CZipAsyncFileOutput(size_t threads = 4, size_t maxPending = 64 * 1024 * 1024);
+	virtual ~CZipAsyncFileOutput(void);
+
+	virtual CZipOutputStream *createFile(const std::string &fileName);
+	virtual bool closeFile(CZipOutputStream *file, time_t time, bool success);
+	virtual size_t finish(std::vector<std::string> *failedFiles = NULL);
+
+private:
+	class AsyncFile;
+
+	struct Operation
+	{
+		AsyncFile *file;
+		std::vector<char> data;
+		bool close;
+		time_t time;
+		bool success;
+	};
+
+	struct Worker
+	{
+		CZipAsyncFileOutput *owner;
+		std::deque<Operation> queue;
+		HANDLE hThread;
+	};
+
+	std::vector<Worker> workers;
+	size_t nextWorker;
+	size_t maxPending;
+	size_t pendingBytes;     // data queued and not yet written
+	size_t outstanding;      // operations queued or running
+	std::vector<std::string> failedFiles;
+	bool stopping;
+
+	CRITICAL_SECTION lock;
+	CONDITION_VARIABLE ready;
+	CONDITION_VARIABLE done;
+
+	void submit(AsyncFile *file, std::vector<char> &data, bool close, time_t time, bool success);
+	static DWORD WINAPI ThreadProc(LPVOID param);
+	void work(Worker &worker);
+	bool run(Operation &operation);
+
+	CZipAsyncFileOutput(const CZipAsyncFileOutput &);
+	CZipAsyncFileOutput &operator=(const CZipAsyncFileOutput &);
+};
+
+#endif
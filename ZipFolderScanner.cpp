@@ -0,0 +1,147 @@
+#include "stdafx.h"
+#include "ZipFolderScanner.h"
+#include "ZipArchive.h"
+
+using namespace std;
+
+CZipFolderScanner::CZipFolderScanner(size_t threads /*= 4*/) : threads(threads > 0 ? threads : 1), pending(0), failed(false)
+{
+	InitializeCriticalSection(&lock);
+	InitializeConditionVariable(&condition);
+}
+
+CZipFolderScanner::~CZipFolderScanner(void)
+{
+	DeleteCriticalSection(&lock);
+}
+
+bool CZipFolderScanner::scan(const string &entryName, const string &folderName, vector<File> &files)
+{
+	folders.clear();
+	queue.clear();
+	pending = 0;
+	failed = false;
+
+	Folder *root = addFolder(entryName, folderName);
+
+	// the calling thread scans too
+	vector<HANDLE> handles;
+	for (size_t i = 1; i < threads; ++i)
+	{
+		HANDLE hThread = CreateThread(NULL, 0, ThreadProc, this, 0, NULL);
+		if (hThread != NULL)
+			handles.push_back(hThread);
+	}
+
+	work();
+
+	for (size_t i = 0; i < handles.size(); ++i)
+	{
+		WaitForSingleObject(handles[i], INFINITE);
+		CloseHandle(handles[i]);
+	}
+
+	if (!failed)
+		collect(*root, files);
+
+	folders.clear();
+	return !failed;
+}
+
+DWORD WINAPI CZipFolderScanner::ThreadProc(LPVOID param)
+{
+	((CZipFolderScanner *)param)->work();
+	return 0;
+}
+
+void CZipFolderScanner::work(void)
+{
+	EnterCriticalSection(&lock);
+	for (;;)
+	{
+		while (queue.empty() && pending > 0 && !failed)
+			SleepConditionVariableCS(&condition, &lock, INFINITE);
+
+		// all folders scanned, or one of them failed
+		if (queue.empty() || failed)
+			break;
+
+		// the most recently found folder first, the queue stays short on deep trees
+		Folder *folder = queue.back();
+		queue.pop_back();
+		LeaveCriticalSection(&lock);
+
+		bool result = scanFolder(*folder);
+
+		EnterCriticalSection(&lock);
+		if (!result)
+			failed = true;
+		if (--pending == 0 || failed)
+			WakeAllConditionVariable(&condition);
+	}
+	LeaveCriticalSection(&lock);
+}
+
+CZipFolderScanner::Folder *CZipFolderScanner::addFolder(const string &entryName, const string &folderName)
+{
+	EnterCriticalSection(&lock);
+	folders.push_back(Folder());
+	Folder *folder = &folders.back();
+	folder->entryName = entryName;
+	folder->folderName = folderName;
+	queue.push_back(folder);
+	++pending;
+	WakeConditionVariable(&condition);
+	LeaveCriticalSection(&lock);
+
+	return folder;
+}
+
+bool CZipFolderScanner::scanFolder(Folder &folder)
+{
+	WIN32_FIND_DATAA fd = {0};
+	string strFind = CZipArchive::concatPath(folder.folderName, "*.*");
+	HANDLE hFind = FindFirstFileExA(strFind.c_str(), FindExInfoBasic, &fd, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+	if (hFind == INVALID_HANDLE_VALUE)
+		return false;
+
+	do
+	{
+		if (strcmp(fd.cFileName, ".") == 0 || strcmp(fd.cFileName, "..") == 0)
+			continue;
+
+		Item item;
+		item.folder = NULL;
+		string fileName = CZipArchive::concatPath(folder.folderName, fd.cFileName);
+		string fileEntryName = CZipArchive::concatPath(folder.entryName, fd.cFileName, '/');
+		if ((fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0)
+		{
+			fileEntryName.push_back('/');
+			item.folder = addFolder(fileEntryName, fileName);
+		}
+		else
+		{
+			item.file.entryName = fileEntryName;
+			item.file.fileName = fileName;
+			item.file.size = ((zip_uint64_t)fd.nFileSizeHigh << 32) | fd.nFileSizeLow;
+			item.file.time = fd.ftLastWriteTime;
+		}
+		folder.items.push_back(item);
+	}
+	while (FindNextFileA(hFind, &fd));
+
+	FindClose(hFind);
+	return true;
+}
+
+void CZipFolderScanner::collect(const Folder &folder, vector<File> &files)
+{
+	vector<Item>::const_iterator it;
+	for (it = folder.items.begin(); it != folder.items.end(); ++it)
+	{
+		if (it->folder != NULL)
+			collect(*it->folder, files);
+		else
+			files.push_back(it->file);
+	}
+}
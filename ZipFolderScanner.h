@@ -0,0 +1,69 @@
+#ifndef ZIPFOLDERSCANNER_H
+#define	ZIPFOLDERSCANNER_H
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <Windows.h>
+
+#include <zipconf.h>
+
+/*
+ * 多线程扫描目录树，列出所有文件
+ * 每个线程从共享队列取一个目录，用FindFirstFileExA(不取短文件名，大缓冲区)列出，
+ * 子目录再放回队列，结果按单线程递归的顺序合并
+ */
+class CZipFolderScanner
+{
+public:
+	struct File
+	{
+		std::string entryName;    // 条目名，目录分隔符为'/'
+		std::string fileName;     // 文件路径
+		zip_uint64_t size;
+		FILETIME time;            // 最后修改时间
+	};
+
+	// threads为扫描线程数(包括调用线程)
+	CZipFolderScanner(size_t threads = 4);
+	virtual ~CZipFolderScanner(void);
+
+	// 列出folderName下的所有文件，entryName为条目名前缀，任何目录无法列出时失败
+	bool scan(const std::string &entryName, const std::string &folderName, std::vector<File> &files);
+
+private:
+	struct Folder;
+
+	// a file, or a subfolder when folder is not NULL, in find order
+	struct Item
+	{
+		Folder *folder;
+		File file;
+	};
+
+	struct Folder
+	{
+		std::string entryName;
+		std::string folderName;
+		std::vector<Item> items;
+	};
+
+	size_t threads;
+	CRITICAL_SECTION lock;
+	CONDITION_VARIABLE condition;
+	std::deque<Folder> folders;      // grows only, elements never move
+	std::vector<Folder *> queue;
+	size_t pending;                  // folders queued or being scanned
+	bool failed;
+
+	static DWORD WINAPI ThreadProc(LPVOID param);
+	void work(void);
+	bool scanFolder(Folder &folder);
+	Folder *addFolder(const std::string &entryName, const std::string &folderName);
+	static void collect(const Folder &folder, std::vector<File> &files);
+
+	CZipFolderScanner(const CZipFolderScanner &);
+	CZipFolderScanner &operator=(const CZipFolderScanner &);
+};
+
+#endif
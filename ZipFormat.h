@@ -0,0 +1,118 @@
+#ifndef ZIPFORMAT_H
+#define	ZIPFORMAT_H
+
+#include <ctime>
+#include <string>
+
+#include <zipconf.h>
+
+/*
+ * zip文件格式常量和小端读写工具
+ * 参考 PKWARE APPNOTE.TXT
+ */
+
+#define ZIP_LOCAL_HEADER_SIG		0x04034b50
+#define ZIP_DATA_DESCRIPTOR_SIG		0x08074b50
+#define ZIP_CENTRAL_HEADER_SIG		0x02014b50
+#define ZIP_END_OF_CENTRAL_SIG		0x06054b50
+#define ZIP64_END_OF_CENTRAL_SIG	0x06064b50
+#define ZIP64_END_LOCATOR_SIG		0x07064b50
+
+#define ZIP_LOCAL_HEADER_SIZE		30
+#define ZIP_CENTRAL_HEADER_SIZE		46
+#define ZIP_END_OF_CENTRAL_SIZE		22
+#define ZIP64_END_OF_CENTRAL_SIZE	56
+#define ZIP64_END_LOCATOR_SIZE		20
+
+#define ZIP64_EXTRA_ID				0x0001
+
+#define ZIP_FLAG_ENCRYPTED			0x0001
+#define ZIP_FLAG_DATA_DESCRIPTOR	0x0008
+#define ZIP_FLAG_UTF8				0x0800
+
+#define ZIP_METHOD_STORE			0
+#define ZIP_METHOD_DEFLATE			8
+
+#define ZIP_VERSION_DEFAULT			20
+#define ZIP_VERSION_ZIP64			45
+
+#define ZIP_UINT16_LIMIT			0xFFFF
+#define ZIP_UINT32_LIMIT			0xFFFFFFFFu
+
+inline void ZipPut16(std::string &out, zip_uint16_t value)
+{
+	out.push_back((char)(value & 0xFF));
+	out.push_back((char)(value >> 8));
+}
+
+inline void ZipPut32(std::string &out, zip_uint32_t value)
+{
+	ZipPut16(out, (zip_uint16_t)(value & 0xFFFF));
+	ZipPut16(out, (zip_uint16_t)(value >> 16));
+}
+
+inline void ZipPut64(std::string &out, zip_uint64_t value)
+{
+	ZipPut32(out, (zip_uint32_t)(value & 0xFFFFFFFFu));
+	ZipPut32(out, (zip_uint32_t)(value >> 32));
+}
+
+inline zip_uint16_t ZipGet16(const unsigned char *p)
+{
+	return (zip_uint16_t)(p[0] | (p[1] << 8));
+}
+
+inline zip_uint32_t ZipGet32(const unsigned char *p)
+{
+	return (zip_uint32_t)ZipGet16(p) | ((zip_uint32_t)ZipGet16(p + 2) << 16);
+}
+
+inline zip_uint64_t ZipGet64(const unsigned char *p)
+{
+	return (zip_uint64_t)ZipGet32(p) | ((zip_uint64_t)ZipGet32(p + 4) << 32);
+}
+
+inline void ZipSet32(unsigned char *p, zip_uint32_t value)
+{
+	p[0] = (unsigned char)(value & 0xFF);
+	p[1] = (unsigned char)((value >> 8) & 0xFF);
+	p[2] = (unsigned char)((value >> 16) & 0xFF);
+	p[3] = (unsigned char)(value >> 24);
+}
+
+inline void ZipSet64(unsigned char *p, zip_uint64_t value)
+{
+	ZipSet32(p, (zip_uint32_t)(value & 0xFFFFFFFFu));
+	ZipSet32(p + 4, (zip_uint32_t)(value >> 32));
+}
+
+// time_t 转换 MS-DOS 日期时间(本地时间)
+inline void ZipTimeToDos(time_t t, zip_uint16_t &dosDate, zip_uint16_t &dosTime)
+{
+	struct tm tm;
+	if (localtime_s(&tm, &t) != 0 || tm.tm_year < 80)
+	{
+		dosDate = (1 << 5) | 1;    // 1980-01-01
+		dosTime = 0;
+		return;
+	}
+
+	dosDate = (zip_uint16_t)(((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday);
+	dosTime = (zip_uint16_t)((tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec >> 1));
+}
+
+// MS-DOS 日期时间转换 time_t
+inline time_t ZipDosToTime(zip_uint16_t dosDate, zip_uint16_t dosTime)
+{
+	struct tm tm = {0};
+	tm.tm_year = ((dosDate >> 9) & 0x7F) + 80;
+	tm.tm_mon = ((dosDate >> 5) & 0x0F) - 1;
+	tm.tm_mday = dosDate & 0x1F;
+	tm.tm_hour = (dosTime >> 11) & 0x1F;
+	tm.tm_min = (dosTime >> 5) & 0x3F;
+	tm.tm_sec = (dosTime & 0x1F) * 2;
+	tm.tm_isdst = -1;
+	return mktime(&tm);
+}
+
+#endif
@@ -0,0 +1,253 @@
+#include "stdafx.h"
+#include <bcrypt.h>
+#include <set>
+#include "ZipHasher.h"
+#include "ZipStream.h"
+
+using namespace std;
+
+CZipHasher::CZipHasher(size_t blockSize /*= 256 * 1024*/, size_t blockCount /*= 4*/) : blockSize(blockSize),
+head(0), tail(0), queued(0), finishing(false), finished(true), stopping(false), failed(false),
+hThread(NULL), hAlgorithm(NULL), hHash(NULL)
+{
+	blocks.resize(blockCount > 1 ? blockCount : 2);
+	for (size_t i = 0; i < blocks.size(); ++i)
+	{
+		blocks[i].data.resize(blockSize);
+		blocks[i].length = 0;
+	}
+
+	InitializeCriticalSection(&lock);
+	InitializeConditionVariable(&blockReady);
+	InitializeConditionVariable(&blockFree);
+
+	BCRYPT_ALG_HANDLE algorithm = NULL;
+	if (BCryptOpenAlgorithmProvider(&algorithm, BCRYPT_SHA256_ALGORITHM, NULL, 0) == 0)
+		hAlgorithm = algorithm;
+}
+
+CZipHasher::~CZipHasher(void)
+{
+	if (hThread != NULL)
+	{
+		EnterCriticalSection(&lock);
+		stopping = true;
+		WakeAllConditionVariable(&blockReady);
+		LeaveCriticalSection(&lock);
+
+		WaitForSingleObject(hThread, INFINITE);
+		CloseHandle(hThread);
+	}
+
+	if (hHash != NULL)
+		BCryptDestroyHash((BCRYPT_HASH_HANDLE)hHash);
+	if (hAlgorithm != NULL)
+		BCryptCloseAlgorithmProvider((BCRYPT_ALG_HANDLE)hAlgorithm, 0);
+
+	DeleteCriticalSection(&lock);
+}
+
+bool CZipHasher::begin(void)
+{
+	if (hAlgorithm == NULL)
+		return false;
+
+	// one thread serves every digest of this hasher
+	if (hThread == NULL)
+	{
+		hThread = CreateThread(NULL, 0, ThreadProc, this, 0, NULL);
+		if (hThread == NULL)
+			return false;
+	}
+
+	// an unfinished digest is dropped
+	if (!finished)
+		finish();
+
+	BCRYPT_HASH_HANDLE hash = NULL;
+	if (BCryptCreateHash((BCRYPT_ALG_HANDLE)hAlgorithm, &hash, NULL, 0, NULL, 0, 0) != 0)
+		return false;
+
+	EnterCriticalSection(&lock);
+	hHash = hash;
+	blocks[tail].length = 0;
+	finishing = false;
+	finished = false;
+	failed = false;
+	LeaveCriticalSection(&lock);
+	return true;
+}
+
+void CZipHasher::update(const void *data, size_t length)
+{
+	const unsigned char *bytes = (const unsigned char *)data;
+	while (length > 0)
+	{
+		Block &block = blocks[tail];
+		size_t count = blockSize - block.length;
+		if (count > length)
+			count = length;
+
+		memcpy(&block.data[block.length], bytes, count);
+		block.length += count;
+		bytes += count;
+		length -= count;
+
+		if (block.length == blockSize)
+			submit(false);
+	}
+}
+
+void CZipHasher::submit(bool last)
+{
+	EnterCriticalSection(&lock);
+	finishing = last;
+	++queued;
+	WakeConditionVariable(&blockReady);
+
+	// the next block to fill must not be waiting for the hash thread
+	tail = (tail + 1) % blocks.size();
+	if (!last)
+	{
+		while (queued == blocks.size())
+			SleepConditionVariableCS(&blockFree, &lock, INFINITE);
+		blocks[tail].length = 0;
+	}
+	LeaveCriticalSection(&lock);
+}
+
+string CZipHasher::finish(void)
+{
+	if (finished)
+		return string();
+
+	submit(true);
+
+	EnterCriticalSection(&lock);
+	while (!finished)
+		SleepConditionVariableCS(&blockFree, &lock, INFINITE);
+	bool result = !failed;
+	LeaveCriticalSection(&lock);
+
+	BCryptDestroyHash((BCRYPT_HASH_HANDLE)hHash);
+	hHash = NULL;
+	if (!result)
+		return string();
+
+	static const char hex[] = "0123456789abcdef";
+	string text;
+	for (size_t i = 0; i < sizeof(digest); ++i)
+	{
+		text.push_back(hex[digest[i] >> 4]);
+		text.push_back(hex[digest[i] & 0x0F]);
+	}
+	return text;
+}
+
+DWORD WINAPI CZipHasher::ThreadProc(LPVOID param)
+{
+	((CZipHasher *)param)->work();
+	return 0;
+}
+
+void CZipHasher::work(void)
+{
+	EnterCriticalSection(&lock);
+	for (;;)
+	{
+		while (queued == 0 && !stopping)
+			SleepConditionVariableCS(&blockReady, &lock, INFINITE);
+		if (queued == 0)
+			break;
+
+		Block &block = blocks[head];
+		bool last = queued == 1 && finishing;
+		LeaveCriticalSection(&lock);
+
+		// hashing runs while the writer fills the other blocks
+		bool result = block.length == 0 ||
+			BCryptHashData((BCRYPT_HASH_HANDLE)hHash, &block.data[0], (ULONG)block.length, 0) == 0;
+		if (last && result)
+			result = BCryptFinishHash((BCRYPT_HASH_HANDLE)hHash, digest, sizeof(digest), 0) == 0;
+
+		EnterCriticalSection(&lock);
+		if (!result)
+			failed = true;
+		head = (head + 1) % blocks.size();
+		--queued;
+		if (last)
+			finished = true;
+		WakeAllConditionVariable(&blockFree);
+	}
+	LeaveCriticalSection(&lock);
+}
+
+bool CZipHashManifest::begin(void)
+{
+	return hasher.begin();
+}
+
+void CZipHashManifest::update(const void *data, size_t length)
+{
+	hasher.update(data, length);
+}
+
+bool CZipHashManifest::finish(const string &name, const string &fileName, zip_uint64_t size, zip_uint32_t crc)
+{
+	Record record;
+	record.digest = hasher.finish();
+	if (record.digest.empty())
+		return false;
+
+	record.name = name;
+	record.fileName = fileName;
+	record.size = size;
+	record.crc = crc;
+	records.push_back(record);
+	return true;
+}
+
+void CZipHashManifest::cancel(void)
+{
+	hasher.finish();
+}
+
+void CZipHashManifest::discard(const vector<string> &fileNames)
+{
+	if (fileNames.empty())
+		return;
+
+	set<string> failed(fileNames.begin(), fileNames.end());
+	vector<Record> kept;
+	vector<Record>::const_iterator it;
+	for (it = records.begin(); it != records.end(); ++it)
+	{
+		if (failed.find(it->fileName) == failed.end())
+			kept.push_back(*it);
+	}
+	records.swap(kept);
+}
+
+bool CZipHashManifest::save(const string &fileName) const
+{
+	string manifest;
+	vector<Record>::const_iterator it;
+	for (it = records.begin(); it != records.end(); ++it)
+	{
+		char fields[64];
+		sprintf_s(fields, sizeof(fields), "\t%llu\t%08x\t", (unsigned long long)it->size, it->crc);
+		manifest.append(it->digest).append(fields).append(it->name).append("\n");
+	}
+
+	HANDLE hFile = CreateFileA(fileName.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	CZipHandleOutputStream output(hFile);
+	bool result = output.write(manifest.data(), manifest.size()) && output.flush();
+	CloseHandle(hFile);
+
+	if (!result)
+		DeleteFileA(fileName.c_str());
+	return result;
+}
@@ -0,0 +1,105 @@
+#ifndef ZIPHASHER_H
+#define	ZIPHASHER_H
+
+#include <string>
+#include <vector>
+#include <Windows.h>
+
+#include <zipconf.h>
+
+/*
+ * 在后台线程计算SHA-256(Windows CNG，需要链接bcrypt.lib)
+ * update把数据复制到块中，块满后交给哈希线程，只有所有块都在等待时才阻塞，
+ * 写文件和计算哈希同时进行
+ */
+class CZipHasher
+{
+public:
+	// blockSize为每块的字节数，blockCount为块数量
+	CZipHasher(size_t blockSize = 256 * 1024, size_t blockCount = 4);
+	virtual ~CZipHasher(void);
+
+	// 开始计算新的摘要，哈希线程或CNG不可用时返回false
+	bool begin(void);
+	void update(const void *data, size_t length);
+
+	// 等待剩余数据处理完，返回小写十六进制的摘要，出错时返回空字符串
+	std::string finish(void);
+
+private:
+	struct Block
+	{
+		std::vector<unsigned char> data;
+		size_t length;
+	};
+
+	size_t blockSize;
+	std::vector<Block> blocks;
+	size_t head;            // next block to hash
+	size_t tail;            // block being filled
+	size_t queued;          // blocks waiting for the hash thread
+	bool finishing;         // the last block is queued
+	bool finished;          // the digest is ready
+	bool stopping;
+	bool failed;
+
+	HANDLE hThread;
+	CRITICAL_SECTION lock;
+	CONDITION_VARIABLE blockReady;
+	CONDITION_VARIABLE blockFree;
+
+	void *hAlgorithm;
+	void *hHash;
+	unsigned char digest[32];
+
+	static DWORD WINAPI ThreadProc(LPVOID param);
+	void work(void);
+	void submit(bool last);
+
+	CZipHasher(const CZipHasher &);
+	CZipHasher &operator=(const CZipHasher &);
+};
+
+/*
+ * 解压时生成的内容清单，每个条目一行：SHA-256、尺寸、crc32和条目名(以'\t'分隔)
+ * 传给CZipArchive::extract或writeEntry，在写文件的同时计算哈希，不需要再读取解压后的文件
+ */
+class CZipHashManifest
+{
+public:
+	struct Record
+	{
+		std::string name;
+		zip_uint64_t size;
+		zip_uint32_t crc;
+		std::string digest;
+		std::string fileName;   // 写入的文件，不保存到清单
+	};
+
+	const std::vector<Record> &getRecords(void) const
+	{
+		return records;
+	}
+
+	void clear(void)
+	{
+		records.clear();
+	}
+
+	bool save(const std::string &fileName) const;
+
+	// 由CZipArchive在写入条目时调用
+	bool begin(void);
+	void update(const void *data, size_t length);
+	bool finish(const std::string &name, const std::string &fileName, zip_uint64_t size, zip_uint32_t crc);
+	void cancel(void);
+
+	// 异步写文件时，去掉最终没有写成功的文件的记录
+	void discard(const std::vector<std::string> &fileNames);
+
+private:
+	CZipHasher hasher;
+	std::vector<Record> records;
+};
+
+#endif
@@ -0,0 +1,131 @@
+#include "stdafx.h"
+#include "ZipMemory.h"
+
+#include <algorithm>
+#include <new>
+
+using namespace std;
+
+namespace
+{
+	class CDefaultResource : public CZipMemoryResource
+	{
+	public:
+		virtual void *allocate(size_t length)
+		{
+			return new(nothrow) char[length];
+		}
+
+		virtual void deallocate(void *data, size_t length)
+		{
+			delete[] (char *)data;
+		}
+	};
+}
+
+CZipMemoryResource *CZipMemoryResource::getDefault(void)
+{
+	static CDefaultResource resource;
+	return &resource;
+}
+
+CZipHeapResource::CZipHeapResource(bool serialize /*= true*/)
+{
+	hHeap = HeapCreate(serialize ? 0 : HEAP_NO_SERIALIZE, 0, 0);
+}
+
+CZipHeapResource::~CZipHeapResource(void)
+{
+	if (hHeap != NULL)
+		HeapDestroy(hHeap);
+}
+
+void *CZipHeapResource::allocate(size_t length)
+{
+	if (hHeap == NULL)
+		return NULL;
+
+	// HeapAlloc(0) still returns a unique block
+	return HeapAlloc(hHeap, 0, length);
+}
+
+void CZipHeapResource::deallocate(void *data, size_t length)
+{
+	if (data != NULL)
+		HeapFree(hHeap, 0, data);
+}
+
+void *CZipArenaResource::allocate(size_t length)
+{
+	return arena.allocate(length);
+}
+
+void CZipArenaResource::deallocate(void *data, size_t length)
+{
+	// freed all at once by release
+}
+
+void CZipArenaResource::release(void)
+{
+	arena.clear();
+}
+
+CZipBuffer::CZipBuffer(CZipMemoryResource *resource /*= NULL*/) : resource(resource), data(NULL), length(0), capacity(0)
+{
+	if (this->resource == NULL)
+		this->resource = CZipMemoryResource::getDefault();
+}
+
+CZipBuffer::~CZipBuffer(void)
+{
+	reset();
+}
+
+bool CZipBuffer::reserve(size_t capacity)
+{
+	if (capacity <= this->capacity && data != NULL)
+		return true;
+
+	char *newData = (char *)resource->allocate(capacity);
+	if (newData == NULL)
+		return false;
+
+	if (length > 0)
+		memcpy(newData, data, length);
+	if (data != NULL)
+		resource->deallocate(data, this->capacity);
+
+	data = newData;
+	this->capacity = capacity;
+	return true;
+}
+
+void CZipBuffer::reset(void)
+{
+	if (data != NULL)
+		resource->deallocate(data, capacity);
+
+	data = NULL;
+	length = 0;
+	capacity = 0;
+}
+
+char *CZipBuffer::release(size_t *capacity /*= NULL*/)
+{
+	if (capacity != NULL)
+		*capacity = this->capacity;
+
+	char *result = data;
+	data = NULL;
+	length = 0;
+	this->capacity = 0;
+	return result;
+}
+
+void CZipBuffer::swap(CZipBuffer &other)
+{
+	std::swap(resource, other.resource);
+	std::swap(data, other.data);
+	std::swap(length, other.length);
+	std::swap(capacity, other.capacity);
+}
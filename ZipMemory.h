@@ -0,0 +1,140 @@
+#ifndef ZIPMEMORY_H
+#define	ZIPMEMORY_H
+
+#include <Windows.h>
+
+#include "ZipArena.h"
+
+/*
+ * 条目缓冲区的内存来源(相当于std::pmr::memory_resource)
+ * CZipBuffer和存档内部读取条目时的临时缓冲区都通过它申请和释放
+ */
+class CZipMemoryResource
+{
+public:
+	virtual ~CZipMemoryResource(void) {}
+
+	// 分配length字节，失败时返回NULL
+	virtual void *allocate(size_t length) = 0;
+
+	// 释放allocate返回的内存，length与分配时相同
+	virtual void deallocate(void *data, size_t length) = 0;
+
+	// 默认的内存来源，用new[]分配，readEntry返回的数据可以直接delete[]
+	static CZipMemoryResource *getDefault(void);
+};
+
+/*
+ * 使用独立Win32堆的内存来源，与进程堆和其他线程的堆互不竞争锁
+ * serialize为false时不加锁，只能在一个线程中使用
+ */
+class CZipHeapResource : public CZipMemoryResource
+{
+public:
+	CZipHeapResource(bool serialize = true);
+	virtual ~CZipHeapResource(void);
+
+	virtual void *allocate(size_t length);
+	virtual void deallocate(void *data, size_t length);
+
+private:
+	HANDLE hHeap;
+
+	CZipHeapResource(const CZipHeapResource &);
+	CZipHeapResource &operator=(const CZipHeapResource &);
+};
+
+/*
+ * 基于CZipArena的内存来源，分配只移动指针，deallocate不做任何事，
+ * 内存在release或析构时一起释放，适合一批请求读取的条目一起丢弃的场合
+ * 只用于每批请求的readEntry(..., CZipBuffer &)，不要设为长期打开的存档的内存来源，否则内存一直增长
+ * 不加锁，每个线程或每批请求使用一个
+ */
+class CZipArenaResource : public CZipMemoryResource
+{
+public:
+	CZipArenaResource(size_t blockSize = 4 * 1024 * 1024) : arena(blockSize) {}
+
+	virtual void *allocate(size_t length);
+	virtual void deallocate(void *data, size_t length);
+
+	// 释放所有分配的内存，之前分配的CZipBuffer不能再访问
+	void release(void);
+
+	// 已分配的字节数
+	size_t getSize(void) const
+	{
+		return arena.getSize();
+	}
+
+private:
+	CZipArena arena;
+
+	CZipArenaResource(const CZipArenaResource &);
+	CZipArenaResource &operator=(const CZipArenaResource &);
+};
+
+/*
+ * 拥有条目数据的缓冲区，析构时通过分配它的内存来源释放
+ * resource为NULL时使用CZipMemoryResource::getDefault()
+ * 不能复制，可以用swap交换或用release取出数据
+ */
+class CZipBuffer
+{
+public:
+	CZipBuffer(CZipMemoryResource *resource = NULL);
+	virtual ~CZipBuffer(void);
+
+	// 保证容量至少为capacity，保留已有的数据，失败时原有数据不变
+	bool reserve(size_t capacity);
+
+	// 释放数据
+	void reset(void);
+
+	// 放弃所有权并返回数据，capacity不为NULL时返回容量，之后由调用者用getResource()->deallocate(data, capacity)释放
+	char *release(size_t *capacity = NULL);
+
+	void swap(CZipBuffer &other);
+
+	char *getData(void) const
+	{
+		return data;
+	}
+
+	size_t getLength(void) const
+	{
+		return length;
+	}
+
+	// 有效数据的长度，不超过容量
+	void setLength(size_t length)
+	{
+		this->length = length <= capacity ? length : capacity;
+	}
+
+	size_t getCapacity(void) const
+	{
+		return capacity;
+	}
+
+	bool isEmpty(void) const
+	{
+		return length == 0;
+	}
+
+	CZipMemoryResource *getResource(void) const
+	{
+		return resource;
+	}
+
+private:
+	CZipMemoryResource *resource;
+	char *data;
+	size_t length;
+	size_t capacity;
+
+	CZipBuffer(const CZipBuffer &);
+	CZipBuffer &operator=(const CZipBuffer &);
+};
+
+#endif
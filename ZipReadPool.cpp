@@ -0,0 +1,222 @@
+#include "stdafx.h"
+#include <malloc.h>
+#include "ZipReadPool.h"
+
+using namespace std;
+
+CZipReadPool::CZipReadPool(const std::string &zipPath, bool isUtf8 /*= false*/, const std::string &password /*= ""*/) : path(zipPath),
+buffer(NULL), password(password), isUtf8(isUtf8), primary(NULL), handleCount(0)
+{
+	InitializeSListHead(&freeHandles);
+}
+
+CZipReadPool::CZipReadPool(std::vector<char> &buffer, bool isUtf8 /*= false*/, const std::string &password /*= ""*/) :
+buffer(&buffer), password(password), isUtf8(isUtf8), primary(NULL), handleCount(0)
+{
+	InitializeSListHead(&freeHandles);
+}
+
+CZipReadPool::~CZipReadPool(void)
+{
+	close();
+}
+
+CZipArchive *CZipReadPool::openHandle(void) const
+{
+	CZipArchive *archive = buffer != NULL ? new CZipArchive(*buffer, isUtf8, password) : new CZipArchive(path, isUtf8, password);
+	if (!archive->open(CZipArchive::READ_ONLY))
+	{
+		delete archive;
+		return NULL;
+	}
+	return archive;
+}
+
+bool CZipReadPool::open(int handleCount, bool checkConsistency)
+{
+	if (isOpen())
+		return false;
+
+	primary = buffer != NULL ? new CZipArchive(*buffer, isUtf8, password) : new CZipArchive(path, isUtf8, password);
+	if (!primary->open(CZipArchive::READ_ONLY, checkConsistency))
+	{
+		delete primary;
+		primary = NULL;
+		return false;
+	}
+
+	// 条目索引只建立一次，所有句柄共用
+	entries = primary->getEntries();
+	nameIndex.clear();
+	for (size_t i = 0; i < entries.size(); ++i)
+		nameIndex[entries[i].getName()] = i;
+
+	Handle *handle = (Handle *)_aligned_malloc(sizeof(Handle), MEMORY_ALLOCATION_ALIGNMENT);
+	if (handle == NULL)
+	{
+		delete primary;
+		primary = NULL;
+		entries.clear();
+		nameIndex.clear();
+		return false;
+	}
+
+	handle->archive = primary;
+	this->handleCount = 1;
+	release(handle);
+
+	for (int i = 1; i < handleCount; ++i)
+	{
+		CZipArchive *archive = openHandle();
+		if (archive == NULL)
+			break;
+
+		handle = (Handle *)_aligned_malloc(sizeof(Handle), MEMORY_ALLOCATION_ALIGNMENT);
+		if (handle == NULL)
+		{
+			delete archive;
+			break;    //the pool still works with fewer handles
+		}
+
+		handle->archive = archive;
+		InterlockedIncrement(&this->handleCount);
+		release(handle);
+	}
+
+	return true;
+}
+
+void CZipReadPool::close(void)
+{
+	if (!isOpen())
+		return;
+
+	Handle *handle;
+	while ((handle = (Handle *)InterlockedPopEntrySList(&freeHandles)) != NULL)
+	{
+		delete handle->archive;
+		_aligned_free(handle);
+	}
+
+	primary = NULL;
+	handleCount = 0;
+	entries.clear();
+	nameIndex.clear();
+}
+
+CZipReadPool::Handle *CZipReadPool::acquire(void) const
+{
+	Handle *handle = (Handle *)InterlockedPopEntrySList(&freeHandles);
+	if (handle != NULL)
+		return handle;
+
+	// 所有句柄都在使用中，再打开一个，以后归还到池中
+	CZipArchive *archive = openHandle();
+	if (archive == NULL)
+		return NULL;
+
+	handle = (Handle *)_aligned_malloc(sizeof(Handle), MEMORY_ALLOCATION_ALIGNMENT);
+	if (handle == NULL)
+	{
+		delete archive;
+		return NULL;
+	}
+
+	handle->archive = archive;
+	InterlockedIncrement(&handleCount);
+	return handle;
+}
+
+void CZipReadPool::release(Handle *handle) const
+{
+	InterlockedPushEntrySList(&freeHandles, &handle->link);
+}
+
+bool CZipReadPool::isOwnEntry(const CZipEntry &zipEntry) const
+{
+	return !zipEntry.isNull() && zipEntry.zipFile == primary && zipEntry.getIndex() < entries.size();
+}
+
+bool CZipReadPool::hasEntry(const std::string &name) const
+{
+	return nameIndex.find(name) != nameIndex.end();
+}
+
+CZipEntry CZipReadPool::getEntry(const std::string &name) const
+{
+	unordered_map<string, size_t>::const_iterator it = nameIndex.find(name);
+	if (it == nameIndex.end())
+		return CZipEntry();
+	return entries[it->second];
+}
+
+void *CZipReadPool::readEntry(const CZipEntry &zipEntry, bool asText) const
+{
+	if (!isOpen() || !isOwnEntry(zipEntry))
+		return NULL;
+
+	Handle *handle = acquire();
+	if (handle == NULL)
+		return NULL;
+
+	void *data = handle->archive->readIndex(zipEntry.getIndex(), zipEntry.getSize(), asText, CZipArchive::CURRENT);
+	release(handle);
+	return data;
+}
+
+void *CZipReadPool::readEntry(const std::string &zipEntry, bool asText) const
+{
+	return readEntry(getEntry(zipEntry), asText);
+}
+
+bool CZipReadPool::readEntry(const CZipEntry &zipEntry, CZipBuffer &buffer, bool asText) const
+{
+	buffer.setLength(0);
+	if (!isOpen() || !isOwnEntry(zipEntry))
+		return false;
+
+	Handle *handle = acquire();
+	if (handle == NULL)
+		return false;
+
+	bool result = handle->archive->readIndex(zipEntry.getIndex(), zipEntry.getSize(), asText, CZipArchive::CURRENT, buffer);
+	release(handle);
+	return result;
+}
+
+bool CZipReadPool::readEntry(const std::string &zipEntry, CZipBuffer &buffer, bool asText) const
+{
+	return readEntry(getEntry(zipEntry), buffer, asText);
+}
+
+std::string CZipReadPool::readString(const std::string &zipEntry) const
+{
+	CZipEntry entry = getEntry(zipEntry);
+	char *content = (char *)readEntry(entry, true);
+	if (content == NULL)
+		return string();
+
+#pragma warning(suppress:4244)
+	string str(content, entry.getSize());
+	delete[] content;
+	return str;
+}
+
+bool CZipReadPool::writeEntry(const CZipEntry &zipEntry, const std::string &fileName) const
+{
+	if (!isOpen() || !isOwnEntry(zipEntry))
+		return false;
+
+	Handle *handle = acquire();
+	if (handle == NULL)
+		return false;
+
+	bool result = handle->archive->writeIndex(zipEntry.getIndex(), zipEntry.getDate(), fileName, CZipArchive::CURRENT);
+	release(handle);
+	return result;
+}
+
+bool CZipReadPool::writeEntry(const std::string &zipEntry, const std::string &fileName) const
+{
+	return writeEntry(getEntry(zipEntry), fileName);
+}
@@ -0,0 +1,99 @@
+#ifndef ZIPREADPOOL_H
+#define	ZIPREADPOOL_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <Windows.h>
+
+#include "ZipArchive.h"
+
+/*
+ * 线程安全的只读zip存档
+ * 维护一组独立打开的只读句柄，所有句柄共享同一份条目索引，
+ * 读取时从无锁栈中取出一个空闲句柄，没有空闲句柄时再打开一个新句柄，
+ * 因此并发的readEntry/readString/writeEntry之间不需要加锁
+ */
+class CZipReadPool
+{
+public:
+	CZipReadPool(const std::string &zipPath, bool isUtf8 = false, const std::string &password = "");
+
+	// 内存存档，buffer在关闭前不能修改
+	CZipReadPool(std::vector<char> &buffer, bool isUtf8 = false, const std::string &password = "");
+
+	virtual ~CZipReadPool(void);
+
+	// 打开存档并建立条目索引，预先打开handleCount个句柄
+	bool open(int handleCount = 1, bool checkConsistency = false);
+
+	// 关闭所有句柄，调用时不能有正在进行的读取
+	void close(void);
+
+	bool isOpen(void) const
+	{
+		return primary != NULL;
+	}
+
+	// 已打开的句柄数
+	LONG getHandleCount(void) const
+	{
+		return handleCount;
+	}
+
+	zip_int64_t getNbEntries(void) const
+	{
+		return (zip_int64_t)entries.size();
+	}
+
+	// 共享的条目索引，打开后不再改变
+	const std::vector<CZipEntry> &getEntries(void) const
+	{
+		return entries;
+	}
+
+	bool hasEntry(const std::string &name) const;
+	CZipEntry getEntry(const std::string &name) const;
+
+	// 读取条目内容，返回的数据需要delete[]
+	void *readEntry(const CZipEntry &zipEntry, bool asText = false) const;
+	void *readEntry(const std::string &zipEntry, bool asText = false) const;
+
+	// 读取条目内容到buffer，由buffer的内存来源分配，每个线程可以使用自己的CZipHeapResource或CZipArenaResource
+	bool readEntry(const CZipEntry &zipEntry, CZipBuffer &buffer, bool asText = false) const;
+	bool readEntry(const std::string &zipEntry, CZipBuffer &buffer, bool asText = false) const;
+	std::string readString(const std::string &zipEntry) const;
+
+	// 将条目内容写入到文件
+	bool writeEntry(const CZipEntry &zipEntry, const std::string &fileName) const;
+	bool writeEntry(const std::string &zipEntry, const std::string &fileName) const;
+
+private:
+	struct Handle
+	{
+		SLIST_ENTRY link;    // must be the first member
+		CZipArchive *archive;
+	};
+
+	std::string path;
+	std::vector<char> *buffer;
+	std::string password;
+	bool isUtf8;
+
+	CZipArchive *primary;
+	std::vector<CZipEntry> entries;
+	std::unordered_map<std::string, size_t> nameIndex;
+
+	mutable SLIST_HEADER freeHandles;
+	mutable LONG handleCount;
+
+	CZipArchive *openHandle(void) const;
+	Handle *acquire(void) const;
+	void release(Handle *handle) const;
+	bool isOwnEntry(const CZipEntry &zipEntry) const;
+
+	CZipReadPool(const CZipReadPool &);
+	CZipReadPool &operator=(const CZipReadPool &);
+};
+
+#endif
@@ -0,0 +1,148 @@
+#include "stdafx.h"
+#include "ZipReadahead.h"
+
+using namespace std;
+
+namespace
+{
+	// WIN32_MEMORY_RANGE_ENTRY, declared here so older SDKs can build
+	struct MemoryRange
+	{
+		PVOID VirtualAddress;
+		SIZE_T NumberOfBytes;
+	};
+
+	typedef BOOL (WINAPI *PrefetchVirtualMemoryFunc)(HANDLE, ULONG_PTR, MemoryRange *, ULONG);
+
+	// available since Windows 8
+	PrefetchVirtualMemoryFunc GetPrefetchVirtualMemory(void)
+	{
+		static PrefetchVirtualMemoryFunc prefetch = (PrefetchVirtualMemoryFunc)GetProcAddress(GetModuleHandleA("kernel32.dll"), "PrefetchVirtualMemory");
+		return prefetch;
+	}
+}
+
+CZipReadahead::CZipReadahead(size_t window /*= 8 * 1024 * 1024*/) : window(window),
+hFile(INVALID_HANDLE_VALUE), hMapping(NULL), view(NULL), fileSize(0), prefetched(0), rangeStart(0), rangeEnd(0)
+{
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	granularity = info.dwAllocationGranularity;
+}
+
+CZipReadahead::~CZipReadahead(void)
+{
+	close();
+}
+
+bool CZipReadahead::open(const string &path)
+{
+	close();
+
+	if (GetPrefetchVirtualMemory() == NULL)
+		return false;
+
+	hFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(hFile, &size) || size.QuadPart == 0)
+	{
+		close();
+		return false;
+	}
+	fileSize = (zip_uint64_t)size.QuadPart;
+
+	hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (hMapping == NULL)
+	{
+		close();
+		return false;
+	}
+
+	prefetched = 0;
+	rangeStart = 0;
+	rangeEnd = 0;
+	return true;
+}
+
+void CZipReadahead::close(void)
+{
+	if (view != NULL)
+	{
+		UnmapViewOfFile(view);
+		view = NULL;
+	}
+
+	if (hMapping != NULL)
+	{
+		CloseHandle(hMapping);
+		hMapping = NULL;
+	}
+
+	if (hFile != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(hFile);
+		hFile = INVALID_HANDLE_VALUE;
+	}
+}
+
+void CZipReadahead::advise(zip_uint64_t offset, zip_uint64_t length)
+{
+	if (!isOpen() || offset >= fileSize)
+		return;
+
+	rangeStart = offset;
+	rangeEnd = length < fileSize - offset ? offset + length : fileSize;
+	if (rangeEnd <= prefetched)
+		return;
+
+	// one window at a time, it covers several small entries and the start of a large one
+	zip_uint64_t start = offset > prefetched ? offset : prefetched;
+	prefetch(start, start + window);
+}
+
+void CZipReadahead::progress(zip_uint64_t done, zip_uint64_t total)
+{
+	if (!isOpen() || total == 0 || prefetched >= rangeEnd)
+		return;
+
+	// compressed data is consumed roughly in proportion to the inflated output
+	double ratio = done < total ? (double)done / total : 1.0;
+	zip_uint64_t position = rangeStart + (zip_uint64_t)((rangeEnd - rangeStart) * ratio);
+
+	// stay half a window ahead of the reader
+	if (position + window / 2 < prefetched)
+		return;
+
+	zip_uint64_t start = position > prefetched ? position : prefetched;
+	prefetch(start, start + window);
+}
+
+void CZipReadahead::prefetch(zip_uint64_t start, zip_uint64_t end)
+{
+	if (end > fileSize)
+		end = fileSize;
+	if (start >= end)
+		return;
+
+	// views must start on the allocation granularity, so a view is at most a window and a granule
+	zip_uint64_t viewStart = start - start % granularity;
+	SIZE_T viewSize = (SIZE_T)(end - viewStart);
+
+	if (view != NULL)
+		UnmapViewOfFile(view);
+
+	// unmapping later does not drop the pages from the system file cache
+	view = MapViewOfFile(hMapping, FILE_MAP_READ, (DWORD)(viewStart >> 32), (DWORD)(viewStart & 0xFFFFFFFF), viewSize);
+	if (view == NULL)
+		return;
+
+	MemoryRange range;
+	range.VirtualAddress = (char *)view + (start - viewStart);
+	range.NumberOfBytes = (SIZE_T)(end - start);
+	GetPrefetchVirtualMemory()(GetCurrentProcess(), 1, &range, 0);
+
+	prefetched = end;
+}
@@ -0,0 +1,53 @@
+#ifndef ZIPREADAHEAD_H
+#define	ZIPREADAHEAD_H
+
+#include <string>
+#include <Windows.h>
+
+#include <zipconf.h>
+
+/*
+ * 顺序读取存档时的预读提示(相当于posix_fadvise的WILLNEED)
+ * 把即将读取的文件区域映射到内存并调用PrefetchVirtualMemory，
+ * 系统在后台把这段数据读入文件缓存，之后libzip读取时直接命中缓存
+ * 系统不支持PrefetchVirtualMemory时不做任何事
+ */
+class CZipReadahead
+{
+public:
+	// window为每次预读的字节数，映射的视图不超过一个窗口
+	CZipReadahead(size_t window = 8 * 1024 * 1024);
+	virtual ~CZipReadahead(void);
+
+	bool open(const std::string &path);
+	void close(void);
+
+	bool isOpen(void) const
+	{
+		return hMapping != NULL;
+	}
+
+	// 提示即将读取[offset, offset + length)，先预读一个窗口，已预读的部分不再重复
+	void advise(zip_uint64_t offset, zip_uint64_t length);
+
+	// 已读取advise范围对应数据total中的done，按比例推算读取位置，接近已预读的末尾时预读下一个窗口
+	void progress(zip_uint64_t done, zip_uint64_t total);
+
+private:
+	size_t window;
+	HANDLE hFile;
+	HANDLE hMapping;
+	void *view;
+	zip_uint64_t fileSize;
+	zip_uint64_t prefetched;    // end of the last prefetched range
+	zip_uint64_t rangeStart;    // range of the last advise
+	zip_uint64_t rangeEnd;
+	DWORD granularity;
+
+	void prefetch(zip_uint64_t start, zip_uint64_t end);
+
+	CZipReadahead(const CZipReadahead &);
+	CZipReadahead &operator=(const CZipReadahead &);
+};
+
+#endif
@@ -0,0 +1,300 @@
+#include "stdafx.h"
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <queue>
+#include "ZipShardWriter.h"
+#include "ZipArchive.h"
+#include "ZipStream.h"
+
+using namespace std;
+
+namespace
+{
+	// files of one directory, placed together when they fit
+	struct Group
+	{
+		zip_uint64_t size;
+		vector<size_t> files;
+
+		Group(void) : size(0) {}
+	};
+
+	bool GroupGreater(const Group &a, const Group &b)
+	{
+		return a.size > b.size;
+	}
+
+	struct SizeGreater
+	{
+		const vector<CZipFolderScanner::File> &files;
+
+		SizeGreater(const vector<CZipFolderScanner::File> &files) : files(files) {}
+
+		bool operator()(size_t a, size_t b) const
+		{
+			return files[a].size > files[b].size;
+		}
+	};
+
+	typedef pair<zip_uint64_t, size_t> Load;    // bytes in a shard, shard index
+}
+
+CZipShardWriter::CZipShardWriter(const string &prefix, bool isUtf8 /*= false*/) : prefix(prefix), isUtf8(isUtf8),
+shardSize(1024 * 1024 * 1024), shardCount(0), threads(4), nextShard(0), failed(0)
+{
+
+}
+
+CZipShardWriter::~CZipShardWriter(void)
+{
+
+}
+
+bool CZipShardWriter::addFolder(const string &entryName, const string &folderName)
+{
+	CZipFolderScanner scanner(threads);
+	return scanner.scan(entryName, folderName, files);
+}
+
+bool CZipShardWriter::addFile(const string &entryName, const string &fileName)
+{
+	HANDLE hFile = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	CZipFolderScanner::File file;
+	LARGE_INTEGER size;
+	bool result = GetFileSizeEx(hFile, &size) && GetFileTime(hFile, NULL, NULL, &file.time);
+	CloseHandle(hFile);
+	if (!result)
+		return false;
+
+	file.entryName = entryName;
+	file.fileName = fileName;
+	file.size = (zip_uint64_t)size.QuadPart;
+	files.push_back(file);
+	return true;
+}
+
+string CZipShardWriter::getShardPath(size_t shard) const
+{
+	char suffix[32];
+	sprintf_s(suffix, sizeof(suffix), ".%03u.zip", (unsigned int)shard);
+	return prefix + suffix;
+}
+
+void CZipShardWriter::pack(void)
+{
+	zip_uint64_t total = 0;
+	map<string, Group> folders;
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		const string &name = files[i].entryName;
+		Group &group = folders[name.substr(0, name.rfind(DIRECTORY_SEPARATOR) + 1)];
+		group.size += files[i].size;
+		group.files.push_back(i);
+		total += files[i].size;
+	}
+
+	size_t count = shardCount;
+	if (count == 0)
+		count = shardSize > 0 ? (size_t)((total + shardSize - 1) / shardSize) : 1;
+	if (count > files.size())
+		count = files.size();
+	if (count == 0)
+		count = 1;
+
+	zip_uint64_t capacity = (shardCount > 0 || shardSize == 0) ? (total + count - 1) / count : shardSize;
+
+	vector<Group> groups;
+	map<string, Group>::iterator it;
+	for (it = folders.begin(); it != folders.end(); ++it)
+		groups.push_back(it->second);
+	stable_sort(groups.begin(), groups.end(), GroupGreater);
+
+	// largest first into the emptiest shard
+	shards.assign(count, Shard());
+	priority_queue<Load, vector<Load>, greater<Load> > loads;
+	for (size_t i = 0; i < count; ++i)
+	{
+		shards[i].size = 0;
+		loads.push(Load(0, i));
+	}
+
+	vector<Group>::iterator git;
+	for (git = groups.begin(); git != groups.end(); ++git)
+	{
+		Group &group = *git;
+		if (loads.top().first + group.size <= capacity || group.files.size() == 1)
+		{
+			Load load = loads.top();
+			loads.pop();
+			Shard &shard = shards[load.second];
+			shard.files.insert(shard.files.end(), group.files.begin(), group.files.end());
+			shard.size += group.size;
+			loads.push(Load(shard.size, load.second));
+			continue;
+		}
+
+		// the directory does not fit anywhere, its files are spread
+		stable_sort(group.files.begin(), group.files.end(), SizeGreater(files));
+		vector<size_t>::const_iterator fit;
+		for (fit = group.files.begin(); fit != group.files.end(); ++fit)
+		{
+			Load load = loads.top();
+			loads.pop();
+			Shard &shard = shards[load.second];
+			shard.files.push_back(*fit);
+			shard.size += files[*fit].size;
+			loads.push(Load(shard.size, load.second));
+		}
+	}
+
+	// entries keep their original order inside a shard
+	for (size_t i = 0; i < count; ++i)
+		sort(shards[i].files.begin(), shards[i].files.end());
+}
+
+bool CZipShardWriter::write(void)
+{
+	if (files.empty())
+		return false;
+
+	pack();
+
+	nextShard = -1;
+	failed = 0;
+
+	// the calling thread writes shards too
+	vector<HANDLE> handles;
+	for (size_t i = 1; i < threads && i < shards.size(); ++i)
+	{
+		HANDLE hThread = CreateThread(NULL, 0, ThreadProc, this, 0, NULL);
+		if (hThread != NULL)
+			handles.push_back(hThread);
+	}
+
+	work();
+
+	for (size_t i = 0; i < handles.size(); ++i)
+	{
+		WaitForSingleObject(handles[i], INFINITE);
+		CloseHandle(handles[i]);
+	}
+
+	if (failed != 0)
+		return false;
+
+	return writeManifest();
+}
+
+DWORD WINAPI CZipShardWriter::ThreadProc(LPVOID param)
+{
+	((CZipShardWriter *)param)->work();
+	return 0;
+}
+
+void CZipShardWriter::work(void)
+{
+	for (;;)
+	{
+		LONG shard = InterlockedIncrement(&nextShard);
+		if (shard >= (LONG)shards.size() || failed != 0)
+			break;
+
+		if (!writeShard((size_t)shard))
+			InterlockedIncrement(&failed);
+	}
+}
+
+bool CZipShardWriter::writeShard(size_t shard)
+{
+	CZipArchive archive(getShardPath(shard), isUtf8);
+	if (!archive.open(CZipArchive::NEW))
+		return false;
+
+	vector<size_t>::const_iterator it;
+	for (it = shards[shard].files.begin(); it != shards[shard].files.end(); ++it)
+	{
+		if (!archive.addFile(files[*it].entryName, files[*it].fileName))
+		{
+			archive.discard();
+			return false;
+		}
+	}
+
+	// every shard is compressed by its own thread here
+	return archive.close();
+}
+
+bool CZipShardWriter::writeManifest(void) const
+{
+	// shard file names are relative to the manifest
+	string::size_type slash = prefix.find_last_of("\\/");
+
+	string manifest;
+	for (size_t i = 0; i < shards.size(); ++i)
+	{
+		string shardName = getShardPath(i);
+		if (slash != string::npos)
+			shardName.erase(0, slash + 1);
+
+		vector<size_t>::const_iterator it;
+		for (it = shards[i].files.begin(); it != shards[i].files.end(); ++it)
+		{
+			char size[32];
+			sprintf_s(size, sizeof(size), "%llu", (unsigned long long)files[*it].size);
+			manifest.append(shardName).append("\t").append(size).append("\t").append(files[*it].entryName).append("\n");
+		}
+	}
+
+	string manifestPath = getManifestPath();
+	HANDLE hFile = CreateFileA(manifestPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	CZipHandleOutputStream output(hFile);
+	bool result = output.write(manifest.data(), manifest.size()) && output.flush();
+	CloseHandle(hFile);
+
+	if (!result)
+		DeleteFileA(manifestPath.c_str());
+	return result;
+}
+
+string CZipShardWriter::findShard(const string &manifestPath, const string &entryName)
+{
+	HANDLE hFile = CreateFileA(manifestPath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return string();
+
+	CZipHandleInputStream input(hFile);
+	string manifest;
+	char buffer[65536];
+	zip_int64_t count;
+	while ((count = input.read(buffer, sizeof(buffer))) > 0)
+		manifest.append(buffer, (size_t)count);
+	CloseHandle(hFile);
+
+	string::size_type start = 0;
+	while (start < manifest.size())
+	{
+		string::size_type end = manifest.find('\n', start);
+		if (end == string::npos)
+			end = manifest.size();
+
+		string::size_type first = manifest.find('\t', start);
+		string::size_type second = first < end ? manifest.find('\t', first + 1) : string::npos;
+		if (second < end && manifest.compare(second + 1, end - second - 1, entryName) == 0)
+		{
+			string shardName = manifest.substr(start, first - start);
+			string::size_type slash = manifestPath.find_last_of("\\/");
+			return slash == string::npos ? shardName : manifestPath.substr(0, slash + 1) + shardName;
+		}
+
+		start = end + 1;
+	}
+
+	return string();
+}
@@ -0,0 +1,101 @@
+#ifndef ZIPSHARDWRITER_H
+#define	ZIPSHARDWRITER_H
+
+#include <string>
+#include <vector>
+#include <Windows.h>
+
+#include <zipconf.h>
+#include "ZipFolderScanner.h"
+
+/*
+ * 把大量文件分成多个尺寸接近的zip存档(分片)，用多个线程同时生成
+ * 按目录从大到小放入当前最小的分片，同一目录的文件尽量在同一个分片，目录放不下时按文件拆开
+ * 所有分片完成后写清单，每行为分片文件名、条目尺寸和条目名(以'\t'分隔)，
+ * 读取时用findShard找到条目所在的分片，只打开这一个分片
+ */
+class CZipShardWriter
+{
+public:
+	// 分片路径为 prefix + ".000.zip"，清单路径为 prefix + ".manifest"
+	CZipShardWriter(const std::string &prefix, bool isUtf8 = false);
+	virtual ~CZipShardWriter(void);
+
+	// 添加目录下的所有文件，entryName为条目名前缀
+	bool addFolder(const std::string &entryName, const std::string &folderName);
+
+	// 添加一个文件
+	bool addFile(const std::string &entryName, const std::string &fileName);
+
+	// 每个分片的目标尺寸(未压缩字节数)，默认1G
+	void setShardSize(zip_uint64_t size)
+	{
+		shardSize = size;
+	}
+
+	// 分片数量，不为0时代替setShardSize，平均分配
+	void setShardCount(size_t count)
+	{
+		shardCount = count;
+	}
+
+	// 同时生成分片的线程数(包括调用线程)
+	void setThreads(size_t threads)
+	{
+		this->threads = threads > 0 ? threads : 1;
+	}
+
+	// 分配条目，生成所有分片和清单
+	bool write(void);
+
+	size_t getShardCount(void) const
+	{
+		return shards.size();
+	}
+
+	// 分片中条目的未压缩尺寸之和
+	zip_uint64_t getShardSize(size_t shard) const
+	{
+		return shards[shard].size;
+	}
+
+	std::string getShardPath(size_t shard) const;
+
+	std::string getManifestPath(void) const
+	{
+		return prefix + ".manifest";
+	}
+
+	// 从清单中查找条目所在的分片路径，没有时返回空字符串
+	static std::string findShard(const std::string &manifestPath, const std::string &entryName);
+
+private:
+	struct Shard
+	{
+		std::vector<size_t> files;    // indices into files, in the order they were added
+		zip_uint64_t size;
+	};
+
+	std::string prefix;
+	bool isUtf8;
+	zip_uint64_t shardSize;
+	size_t shardCount;
+	size_t threads;
+	std::vector<CZipFolderScanner::File> files;
+	std::vector<Shard> shards;
+	volatile LONG nextShard;
+	volatile LONG failed;
+
+	// 把文件分配到分片
+	void pack(void);
+
+	static DWORD WINAPI ThreadProc(LPVOID param);
+	void work(void);
+	bool writeShard(size_t shard);
+	bool writeManifest(void) const;
+
+	CZipShardWriter(const CZipShardWriter &);
+	CZipShardWriter &operator=(const CZipShardWriter &);
+};
+
+#endif
@@ -0,0 +1,60 @@
+#include "stdafx.h"
+#include "ZipStream.h"
+
+zip_int64_t CZipHandleInputStream::read(void *data, size_t length)
+{
+	DWORD toRead = length > 0x40000000 ? 0x40000000 : (DWORD)length;
+	DWORD dwRead = 0;
+	if (!ReadFile(handle, data, toRead, &dwRead, NULL))
+	{
+		// a pipe whose writer closed normally reports a broken pipe instead of a zero-length read
+		DWORD error = GetLastError();
+		return error == ERROR_BROKEN_PIPE || error == ERROR_HANDLE_EOF ? 0 : -1;
+	}
+	return dwRead;
+}
+
+CZipHandleRandomInput::CZipHandleRandomInput(HANDLE handle) : handle(handle), size(0)
+{
+	LARGE_INTEGER fileSize;
+	if (GetFileSizeEx(handle, &fileSize))
+		size = (zip_uint64_t)fileSize.QuadPart;
+}
+
+bool CZipHandleRandomInput::readAt(zip_uint64_t offset, void *data, size_t length)
+{
+	char *bytes = (char *)data;
+	while (length > 0)
+	{
+		// positioned read, independent of the current file pointer
+		OVERLAPPED overlapped = {0};
+		overlapped.Offset = (DWORD)(offset & 0xFFFFFFFF);
+		overlapped.OffsetHigh = (DWORD)(offset >> 32);
+
+		DWORD toRead = length > 0x40000000 ? 0x40000000 : (DWORD)length;
+		DWORD dwRead = 0;
+		if (!ReadFile(handle, bytes, toRead, &dwRead, &overlapped) || dwRead == 0)
+			return false;
+
+		bytes += dwRead;
+		offset += dwRead;
+		length -= dwRead;
+	}
+	return true;
+}
+
+bool CZipHandleOutputStream::write(const void *data, size_t length)
+{
+	const char *bytes = (const char *)data;
+	while (length > 0)
+	{
+		DWORD toWrite = length > 0x40000000 ? 0x40000000 : (DWORD)length;
+		DWORD dwWritten = 0;
+		if (!WriteFile(handle, bytes, toWrite, &dwWritten, NULL) || dwWritten == 0)
+			return false;
+
+		bytes += dwWritten;
+		length -= dwWritten;
+	}
+	return true;
+}
@@ -0,0 +1,154 @@
+#ifndef ZIPSTREAM_H
+#define	ZIPSTREAM_H
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include <Windows.h>
+
+#include <zipconf.h>
+
+// 只读输入流(文件、管道、套接字等)
+class CZipInputStream
+{
+public:
+	virtual ~CZipInputStream(void) {}
+
+	// 返回读取的字节数，0为结束，-1为错误
+	virtual zip_int64_t read(void *data, size_t length) = 0;
+};
+
+// 从Win32句柄读取(文件、命名管道、套接字句柄)
+class CZipHandleInputStream : public CZipInputStream
+{
+public:
+	CZipHandleInputStream(HANDLE handle) : handle(handle) {}
+
+	virtual zip_int64_t read(void *data, size_t length);
+
+private:
+	HANDLE handle;
+};
+
+// 从内存读取
+class CZipBufferInputStream : public CZipInputStream
+{
+public:
+	CZipBufferInputStream(const void *data, size_t length) : data((const char *)data), length(length), position(0) {}
+
+	virtual zip_int64_t read(void *buffer, size_t count)
+	{
+		size_t available = length - position;
+		if (count > available)
+			count = available;
+		memcpy(buffer, data + position, count);
+		position += count;
+		return (zip_int64_t)count;
+	}
+
+private:
+	const char *data;
+	size_t length;
+	size_t position;
+};
+
+// 可随机读取的输入(文件、内存)
+class CZipRandomInput
+{
+public:
+	virtual ~CZipRandomInput(void) {}
+
+	virtual zip_uint64_t getSize(void) const = 0;
+
+	// 从offset处读取length字节，不足length字节时返回false
+	virtual bool readAt(zip_uint64_t offset, void *data, size_t length) = 0;
+};
+
+// 按位置读取Win32文件句柄
+class CZipHandleRandomInput : public CZipRandomInput
+{
+public:
+	CZipHandleRandomInput(HANDLE handle);
+
+	virtual zip_uint64_t getSize(void) const
+	{
+		return size;
+	}
+
+	virtual bool readAt(zip_uint64_t offset, void *data, size_t length);
+
+private:
+	HANDLE handle;
+	zip_uint64_t size;
+};
+
+// 随机读取内存
+class CZipBufferRandomInput : public CZipRandomInput
+{
+public:
+	CZipBufferRandomInput(const void *data, size_t length) : data((const char *)data), length(length) {}
+
+	virtual zip_uint64_t getSize(void) const
+	{
+		return length;
+	}
+
+	virtual bool readAt(zip_uint64_t offset, void *buffer, size_t count)
+	{
+		if (offset > length || count > length - offset)
+			return false;
+		memcpy(buffer, data + offset, count);
+		return true;
+	}
+
+private:
+	const char *data;
+	size_t length;
+};
+
+// 只写输出流(文件、管道、套接字等)
+class CZipOutputStream
+{
+public:
+	virtual ~CZipOutputStream(void) {}
+
+	virtual bool write(const void *data, size_t length) = 0;
+
+	virtual bool flush(void)
+	{
+		return true;
+	}
+};
+
+// 写入Win32句柄(文件、命名管道、套接字句柄)
+class CZipHandleOutputStream : public CZipOutputStream
+{
+public:
+	CZipHandleOutputStream(HANDLE handle) : handle(handle) {}
+
+	virtual bool write(const void *data, size_t length);
+
+private:
+	HANDLE handle;
+};
+
+// 写入内存缓冲区
+class CZipBufferOutputStream : public CZipOutputStream
+{
+public:
+	CZipBufferOutputStream(std::vector<char> &buffer) : buffer(buffer) {}
+
+	virtual bool write(const void *data, size_t length)
+	{
+		const char *bytes = (const char *)data;
+		buffer.insert(buffer.end(), bytes, bytes + length);
+		return true;
+	}
+
+private:
+	std::vector<char> &buffer;
+
+	CZipBufferOutputStream &operator=(const CZipBufferOutputStream &);
+};
+
+#endif
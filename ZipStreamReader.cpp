@@ -0,0 +1,576 @@
+#include "stdafx.h"
+#include <zlib.h>
+#include "ZipArchive.h"
+#include "ZipStreamReader.h"
+#include "ZipFormat.h"
+
+using namespace std;
+
+#define STREAM_BUFFER_SIZE	(64 * 1024)
+
+zip_int64_t CZipStreamEntry::read(void *data, size_t length)
+{
+	if (reader == NULL)
+		return -1;
+
+	return reader->readData(data, length);
+}
+
+CZipStreamReader::CZipStreamReader(CZipInputStream &input, bool isUtf8 /*= false*/) : input(input), isUtf8(isUtf8),
+error(ERROR_NONE), inputEnd(false), bufferStart(0), bufferEnd(0), position(0), stream(NULL),
+dataMode(DATA_DONE), remaining(0), consumed(0), produced(0), crc(0)
+{
+	buffer.resize(STREAM_BUFFER_SIZE);
+}
+
+CZipStreamReader::~CZipStreamReader(void)
+{
+	if (stream)
+	{
+		inflateEnd(stream);
+		delete stream;
+	}
+}
+
+bool CZipStreamReader::fail(Error error)
+{
+	if (this->error == ERROR_NONE)
+		this->error = error;
+	dataMode = DATA_DONE;
+	return false;
+}
+
+bool CZipStreamReader::fill(size_t count)
+{
+	if (bufferEnd - bufferStart >= count)
+		return true;
+
+	if (bufferStart > 0)
+	{
+		memmove(&buffer[0], &buffer[bufferStart], bufferEnd - bufferStart);
+		bufferEnd -= bufferStart;
+		bufferStart = 0;
+	}
+
+	while (bufferEnd < count && !inputEnd)
+	{
+		zip_int64_t result = input.read(&buffer[bufferEnd], buffer.size() - bufferEnd);
+		if (result < 0)
+			return fail(ERROR_READ);
+		if (result == 0)
+			inputEnd = true;
+		bufferEnd += (size_t)result;
+	}
+
+	return bufferEnd >= count;
+}
+
+bool CZipStreamReader::readBytes(void *data, size_t count)
+{
+	char *bytes = (char *)data;
+	while (count > 0)
+	{
+		if (bufferStart == bufferEnd && !fill(1))
+			return fail(ERROR_READ);
+
+		size_t chunk = bufferEnd - bufferStart;
+		if (chunk > count)
+			chunk = count;
+
+		memcpy(bytes, &buffer[bufferStart], chunk);
+		bufferStart += chunk;
+		position += chunk;
+		bytes += chunk;
+		count -= chunk;
+	}
+	return true;
+}
+
+bool CZipStreamReader::skipBytes(zip_uint64_t count)
+{
+	while (count > 0)
+	{
+		if (bufferStart == bufferEnd && !fill(1))
+			return fail(ERROR_READ);
+
+		size_t chunk = bufferEnd - bufferStart;
+		if (chunk > count)
+			chunk = (size_t)count;
+
+		bufferStart += chunk;
+		position += chunk;
+		count -= chunk;
+	}
+	return true;
+}
+
+zip_int64_t CZipStreamReader::readData(void *data, size_t length)
+{
+	if (dataMode == DATA_DONE || length == 0)
+		return 0;
+
+	if (dataMode == DATA_STORED)
+	{
+		if (bufferStart == bufferEnd && !fill(1))
+		{
+			fail(ERROR_READ);
+			return -1;
+		}
+
+		size_t count = bufferEnd - bufferStart;
+		if (count > length)
+			count = length;
+		if (count > remaining)
+			count = (size_t)remaining;
+
+		memcpy(data, &buffer[bufferStart], count);
+		bufferStart += count;
+		position += count;
+		consumed += count;
+		produced += count;
+		remaining -= count;
+		crc = crc32(crc, (const Bytef *)data, (uInt)count);
+
+		if (remaining == 0)
+			dataMode = DATA_DONE;
+		return count;
+	}
+
+	if (dataMode == DATA_STORED_DESCRIPTOR)
+	{
+		/*
+		 * The end of stored data with a data descriptor is only known by
+		 * finding a descriptor whose crc and sizes match the data read so far.
+		 */
+		if (bufferEnd - bufferStart < 4 && !fill(4))
+		{
+			fail(ERROR_READ);
+			return -1;
+		}
+
+		const unsigned char *bytes = (const unsigned char *)&buffer[bufferStart];
+		size_t limit = bufferEnd - bufferStart - 3;
+		size_t found = 0;
+		while (found < limit && ZipGet32(bytes + found) != ZIP_DATA_DESCRIPTOR_SIG)
+			++found;
+
+		if (found == 0)
+		{
+			if (!fill(16))
+			{
+				fail(ERROR_READ);
+				return -1;
+			}
+			fill(24);
+			bytes = (const unsigned char *)&buffer[bufferStart];
+
+			bool match = ZipGet32(bytes + 4) == crc && ZipGet32(bytes + 8) == consumed && ZipGet32(bytes + 12) == consumed;
+			if (!match && bufferEnd - bufferStart >= 24)
+				match = ZipGet32(bytes + 4) == crc && ZipGet64(bytes + 8) == consumed && ZipGet64(bytes + 16) == consumed;
+
+			if (match)
+			{
+				dataMode = DATA_DONE;
+				return 0;
+			}
+			found = 1;    //the signature is part of the data
+		}
+
+		size_t count = found < length ? found : length;
+		memcpy(data, bytes, count);
+		bufferStart += count;
+		position += count;
+		consumed += count;
+		produced += count;
+		crc = crc32(crc, (const Bytef *)data, (uInt)count);
+		return count;
+	}
+
+	// DATA_DEFLATED
+	for (;;)
+	{
+		if (bufferStart == bufferEnd && !fill(1))
+		{
+			fail(ERROR_READ);
+			return -1;
+		}
+
+		size_t available = bufferEnd - bufferStart;
+		stream->next_in = (Bytef *)&buffer[bufferStart];
+		stream->avail_in = (uInt)available;
+		stream->next_out = (Bytef *)data;
+		stream->avail_out = length > 0x40000000 ? 0x40000000 : (uInt)length;
+		uInt outSize = stream->avail_out;
+
+		int result = inflate(stream, Z_NO_FLUSH);
+		if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR)
+		{
+			fail(ERROR_FORMAT);
+			return -1;
+		}
+
+		size_t used = available - stream->avail_in;
+		size_t count = outSize - stream->avail_out;
+		bufferStart += used;
+		position += used;
+		consumed += used;
+		produced += count;
+		crc = crc32(crc, (const Bytef *)data, (uInt)count);
+
+		if (result == Z_STREAM_END)
+			dataMode = DATA_DONE;
+
+		if (count > 0 || dataMode == DATA_DONE)
+			return count;
+	}
+}
+
+bool CZipStreamReader::readDescriptor(Record &record, bool zip64)
+{
+	if (!fill(4))
+		return fail(ERROR_READ);
+
+	if (ZipGet32((const unsigned char *)&buffer[bufferStart]) == ZIP_DATA_DESCRIPTOR_SIG && !skipBytes(4))
+		return false;
+
+	if (!fill(12))
+		return fail(ERROR_READ);
+
+	const unsigned char *bytes = (const unsigned char *)&buffer[bufferStart];
+	record.crc = ZipGet32(bytes);
+
+	// writers don't agree on when the descriptor uses 64 bit sizes, prefer the layout that fits
+	if (!zip64 && ZipGet32(bytes + 4) != (zip_uint32_t)consumed && fill(20))
+	{
+		bytes = (const unsigned char *)&buffer[bufferStart];
+		zip64 = ZipGet64(bytes + 4) == consumed;
+	}
+
+	if (zip64)
+	{
+		if (!fill(20))
+			return fail(ERROR_READ);
+		bytes = (const unsigned char *)&buffer[bufferStart];
+		record.sizeComp = ZipGet64(bytes + 4);
+		record.size = ZipGet64(bytes + 12);
+		return skipBytes(20);
+	}
+
+	record.sizeComp = ZipGet32(bytes + 4);
+	record.size = ZipGet32(bytes + 8);
+	return skipBytes(12);
+}
+
+bool CZipStreamReader::readEntry(zip_uint32_t signature, EntryCallback callback, void *userData)
+{
+	unsigned char header[ZIP_LOCAL_HEADER_SIZE - 4];
+	Record record;
+	record.offset = position - 4;
+
+	if (!readBytes(header, sizeof(header)))
+		return false;
+
+	zip_uint16_t flags = ZipGet16(header + 2);
+	zip_uint16_t method = ZipGet16(header + 4);
+	zip_uint16_t dosTime = ZipGet16(header + 6);
+	zip_uint16_t dosDate = ZipGet16(header + 8);
+	record.crc = ZipGet32(header + 10);
+	record.sizeComp = ZipGet32(header + 14);
+	record.size = ZipGet32(header + 18);
+	zip_uint16_t nameLength = ZipGet16(header + 22);
+	zip_uint16_t extraLength = ZipGet16(header + 24);
+
+	record.rawName.resize(nameLength);
+	if (nameLength > 0 && !readBytes(&record.rawName[0], nameLength))
+		return false;
+
+	vector<unsigned char> extra(extraLength);
+	if (extraLength > 0 && !readBytes(&extra[0], extraLength))
+		return false;
+
+	bool zip64 = false;
+	for (size_t i = 0; i + 4 <= extra.size();)
+	{
+		zip_uint16_t id = ZipGet16(&extra[i]);
+		zip_uint16_t length = ZipGet16(&extra[i + 2]);
+		if (i + 4 + length > extra.size())
+			break;
+
+		if (id == ZIP64_EXTRA_ID)
+		{
+			zip64 = true;
+			const unsigned char *field = &extra[i + 4];
+			const unsigned char *end = field + length;
+			if (record.size == ZIP_UINT32_LIMIT && field + 8 <= end)
+			{
+				record.size = ZipGet64(field);
+				field += 8;
+			}
+			if (record.sizeComp == ZIP_UINT32_LIMIT && field + 8 <= end)
+				record.sizeComp = ZipGet64(field);
+		}
+		i += 4 + length;
+	}
+
+	if ((flags & ZIP_FLAG_ENCRYPTED) != 0)
+		return fail(ERROR_UNSUPPORTED);
+
+	bool descriptor = (flags & ZIP_FLAG_DATA_DESCRIPTOR) != 0;
+	if (method == ZIP_METHOD_DEFLATE)
+	{
+		if (stream == NULL)
+		{
+			stream = new z_stream;
+			memset(stream, 0, sizeof(z_stream));
+			if (inflateInit2(stream, -MAX_WBITS) != Z_OK)
+			{
+				delete stream;
+				stream = NULL;
+				return fail(ERROR_FORMAT);
+			}
+		}
+		else if (inflateReset(stream) != Z_OK)
+		{
+			return fail(ERROR_FORMAT);
+		}
+		dataMode = DATA_DEFLATED;
+	}
+	else if (method == ZIP_METHOD_STORE)
+	{
+		dataMode = descriptor ? DATA_STORED_DESCRIPTOR : DATA_STORED;
+		remaining = record.sizeComp;
+		if (dataMode == DATA_STORED && remaining == 0)
+			dataMode = DATA_DONE;
+	}
+	else
+	{
+		return fail(ERROR_UNSUPPORTED);
+	}
+
+	consumed = 0;
+	produced = 0;
+	crc = crc32(0L, Z_NULL, 0);
+
+	CZipStreamEntry entry;
+	entry.reader = this;
+	entry.name = Utf8ToAscii(record.rawName);
+	entry.time = ZipDosToTime(dosDate, dosTime);
+	entry.method = method;
+	entry.size = descriptor ? 0 : record.size;
+
+	if (callback != NULL && !callback(entry, userData))
+		return fail(ERROR_ABORTED);
+
+	// whatever the callback didn't read is still verified
+	char data[16 * 1024];
+	zip_int64_t result;
+	while ((result = readData(data, sizeof(data))) > 0);
+	if (result < 0 || error != ERROR_NONE)
+		return false;
+
+	if (descriptor && !readDescriptor(record, zip64))
+		return false;
+
+	if (record.crc != crc || record.size != produced || record.sizeComp != consumed)
+		return fail(ERROR_CRC);
+
+	records.push_back(record);
+	return true;
+}
+
+bool CZipStreamReader::readCentralDirectory(zip_uint32_t signature)
+{
+	unsigned char bytes[ZIP_CENTRAL_HEADER_SIZE];
+	size_t index = 0;
+
+	for (;;)
+	{
+		if (signature == ZIP_CENTRAL_HEADER_SIG)
+		{
+			if (!readBytes(bytes + 4, ZIP_CENTRAL_HEADER_SIZE - 4))
+				return false;
+
+			zip_uint32_t entryCrc = ZipGet32(bytes + 16);
+			zip_uint64_t sizeComp = ZipGet32(bytes + 20);
+			zip_uint64_t size = ZipGet32(bytes + 24);
+			zip_uint16_t nameLength = ZipGet16(bytes + 28);
+			zip_uint16_t extraLength = ZipGet16(bytes + 30);
+			zip_uint16_t commentLength = ZipGet16(bytes + 32);
+			zip_uint64_t offset = ZipGet32(bytes + 42);
+
+			string rawName(nameLength, '\0');
+			if (nameLength > 0 && !readBytes(&rawName[0], nameLength))
+				return false;
+
+			vector<unsigned char> extra(extraLength);
+			if (extraLength > 0 && !readBytes(&extra[0], extraLength))
+				return false;
+
+			for (size_t i = 0; i + 4 <= extra.size();)
+			{
+				zip_uint16_t id = ZipGet16(&extra[i]);
+				zip_uint16_t length = ZipGet16(&extra[i + 2]);
+				if (i + 4 + length > extra.size())
+					break;
+
+				if (id == ZIP64_EXTRA_ID)
+				{
+					const unsigned char *field = &extra[i + 4];
+					const unsigned char *end = field + length;
+					if (size == ZIP_UINT32_LIMIT && field + 8 <= end)
+					{
+						size = ZipGet64(field);
+						field += 8;
+					}
+					if (sizeComp == ZIP_UINT32_LIMIT && field + 8 <= end)
+					{
+						sizeComp = ZipGet64(field);
+						field += 8;
+					}
+					if (offset == ZIP_UINT32_LIMIT && field + 8 <= end)
+						offset = ZipGet64(field);
+				}
+				i += 4 + length;
+			}
+
+			if (!skipBytes(commentLength))
+				return false;
+
+			if (index >= records.size())
+				return fail(ERROR_DIRECTORY);
+
+			const Record &record = records[index++];
+			if (record.rawName != rawName || record.offset != offset || record.crc != entryCrc ||
+				record.size != size || record.sizeComp != sizeComp)
+				return fail(ERROR_DIRECTORY);
+		}
+		else if (signature == ZIP64_END_OF_CENTRAL_SIG)
+		{
+			unsigned char length[8];
+			if (!readBytes(length, sizeof(length)) || !skipBytes(ZipGet64(length)))
+				return false;
+		}
+		else if (signature == ZIP64_END_LOCATOR_SIG)
+		{
+			if (!skipBytes(ZIP64_END_LOCATOR_SIZE - 4))
+				return false;
+		}
+		else if (signature == ZIP_END_OF_CENTRAL_SIG)
+		{
+			if (!readBytes(bytes + 4, ZIP_END_OF_CENTRAL_SIZE - 4))
+				return false;
+
+			zip_uint16_t count = ZipGet16(bytes + 10);
+			if (index != records.size() || (count != ZIP_UINT16_LIMIT && count != (records.size() & 0xFFFF)))
+				return fail(ERROR_DIRECTORY);
+
+			return skipBytes(ZipGet16(bytes + 20));
+		}
+		else
+		{
+			return fail(ERROR_FORMAT);
+		}
+
+		if (!readBytes(bytes, 4))
+			return false;
+		signature = ZipGet32(bytes);
+	}
+}
+
+bool CZipStreamReader::read(EntryCallback callback, void *userData)
+{
+	error = ERROR_NONE;
+	records.clear();
+
+	unsigned char bytes[4];
+	for (;;)
+	{
+		if (!readBytes(bytes, sizeof(bytes)))
+			return false;
+
+		zip_uint32_t signature = ZipGet32(bytes);
+		if (signature == ZIP_LOCAL_HEADER_SIG)
+		{
+			if (!readEntry(signature, callback, userData))
+				return false;
+		}
+		else if (signature == ZIP_DATA_DESCRIPTOR_SIG && position == 4)
+		{
+			continue;    //spanned archive marker
+		}
+		else
+		{
+			return readCentralDirectory(signature);
+		}
+	}
+}
+
+namespace
+{
+	struct ExtractContext
+	{
+		string folderName;
+		int counter;
+		bool failed;
+	};
+
+	bool ExtractEntry(CZipStreamEntry &entry, void *userData)
+	{
+		ExtractContext *context = (ExtractContext *)userData;
+		string extractPath = CZipArchive::concatPath(context->folderName, entry.getName());
+		if (entry.isDirectory())
+		{
+			CZipArchive::createFolder(extractPath);
+			return true;
+		}
+
+		CZipArchive::createFolder(CZipArchive::getFolderPath(extractPath));
+		HANDLE hFile = CreateFileA(extractPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL);
+		if (hFile == INVALID_HANDLE_VALUE)
+		{
+			context->failed = true;
+			return false;
+		}
+
+		char data[16 * 1024];
+		zip_int64_t readCount;
+		bool written = true;
+		CZipHandleOutputStream output(hFile);
+		while ((readCount = entry.read(data, sizeof(data))) > 0)
+		{
+			written = output.write(data, (size_t)readCount);
+			if (!written)
+				break;
+		}
+
+		// a full disk, a bad crc or truncated data leave no partial file behind
+		if (!written || readCount < 0)
+		{
+			CloseHandle(hFile);
+			DeleteFileA(extractPath.c_str());
+			context->failed = true;
+			return false;
+		}
+
+		FILETIME ftUTC;
+		CZipArchive::TimetToFileTime(entry.getDate(), &ftUTC);
+		SetFileTime(hFile, &ftUTC, &ftUTC, &ftUTC);
+		CloseHandle(hFile);
+
+		++context->counter;
+		return true;
+	}
+}
+
+int CZipStreamReader::extract(const std::string &folderName)
+{
+	ExtractContext context;
+	context.folderName = folderName;
+	context.counter = 0;
+	context.failed = false;
+
+	if (!read(ExtractEntry, &context))
+		return -1;
+
+	return context.counter;
+}
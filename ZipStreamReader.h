@@ -0,0 +1,155 @@
+#ifndef ZIPSTREAMREADER_H
+#define	ZIPSTREAMREADER_H
+
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include <zipconf.h>
+#include "UnicodeConv.h"
+#include "ZipStream.h"
+
+struct z_stream_s;
+class CZipStreamReader;
+
+// 流式读取中的当前条目，数据只能按顺序读取一次
+class CZipStreamEntry
+{
+	friend class CZipStreamReader;
+
+public:
+	std::string getName(void) const
+	{
+		return name;
+	}
+
+	time_t getDate(void) const
+	{
+		return time;
+	}
+
+	int getMethod(void) const
+	{
+		return method;
+	}
+
+	// 本地文件头中的未压缩尺寸，使用数据描述符时为0
+	zip_uint64_t getSize(void) const
+	{
+		return size;
+	}
+
+	bool isDirectory(void) const
+	{
+		return name.length() > 0 && name[name.length() - 1] == '/';
+	}
+
+	bool isFile(void) const
+	{
+		return !isDirectory();
+	}
+
+	// 读取解压后的数据，返回读取的字节数，0为结束，-1为错误
+	zip_int64_t read(void *data, size_t length);
+
+private:
+	CZipStreamReader *reader;
+	std::string name;
+	time_t time;
+	int method;
+	zip_uint64_t size;
+
+	CZipStreamEntry(void) : reader(NULL), time(0), method(0), size(0) {}
+};
+
+/*
+ * 只向前读的zip读取器，不需要可定位的输入
+ * 按顺序解析本地文件头并解压数据，支持数据描述符和ZIP64，
+ * 输入结束后用末尾的中央目录校验已读取的条目
+ */
+class CZipStreamReader
+{
+	friend class CZipStreamEntry;
+
+public:
+	enum Error
+	{
+		ERROR_NONE,
+		ERROR_READ,           // 输入流读取失败或提前结束
+		ERROR_FORMAT,         // 数据格式错误
+		ERROR_UNSUPPORTED,    // 加密或不支持的压缩方法
+		ERROR_CRC,            // CRC或尺寸不一致
+		ERROR_DIRECTORY,      // 中央目录与已读取的条目不一致
+		ERROR_ABORTED         // 回调函数中止了读取
+	};
+
+	// 回调函数返回false时停止读取
+	typedef bool (*EntryCallback)(CZipStreamEntry &entry, void *userData);
+
+	CZipStreamReader(CZipInputStream &input, bool isUtf8 = false);
+	virtual ~CZipStreamReader(void);
+
+	// 读取整个存档，每个条目调用一次callback，成功时返回true
+	bool read(EntryCallback callback, void *userData = NULL);
+
+	// 边读取边解压到目录，返回解压的文件数，出错时返回-1
+	int extract(const std::string &folderName);
+
+	Error getError(void) const
+	{
+		return error;
+	}
+
+	// 已读取的条目数
+	zip_uint64_t getNbEntries(void) const
+	{
+		return records.size();
+	}
+
+private:
+	struct Record
+	{
+		std::string rawName;
+		zip_uint64_t offset;
+		zip_uint64_t size;
+		zip_uint64_t sizeComp;
+		zip_uint32_t crc;
+	};
+
+	enum DataMode { DATA_STORED, DATA_STORED_DESCRIPTOR, DATA_DEFLATED, DATA_DONE };
+
+	CZipInputStream &input;
+	bool isUtf8;
+	Error error;
+	bool inputEnd;
+
+	std::vector<char> buffer;
+	size_t bufferStart;
+	size_t bufferEnd;
+	zip_uint64_t position;
+
+	std::vector<Record> records;
+	z_stream_s *stream;
+
+	// state of the entry being read
+	DataMode dataMode;
+	zip_uint64_t remaining;
+	zip_uint64_t consumed;
+	zip_uint64_t produced;
+	zip_uint32_t crc;
+
+	bool fill(size_t count);
+	bool readBytes(void *data, size_t count);
+	bool skipBytes(zip_uint64_t count);
+
+	bool readEntry(zip_uint32_t signature, EntryCallback callback, void *userData);
+	zip_int64_t readData(void *data, size_t length);
+	bool readDescriptor(Record &record, bool zip64);
+	bool readCentralDirectory(zip_uint32_t signature);
+	bool fail(Error error);
+
+	CZipStreamReader(const CZipStreamReader &);
+	CZipStreamReader &operator=(const CZipStreamReader &);
+};
+
+#endif
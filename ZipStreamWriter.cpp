@@ -0,0 +1,472 @@
+#include "stdafx.h"
+#include <zlib.h>
+#include "ZipArchive.h"
+#include "ZipStreamWriter.h"
+#include "ZipDirectory.h"
+#include "ZipFormat.h"
+
+using namespace std;
+
+#define STREAM_BUFFER_SIZE	(64 * 1024)
+
+CZipStreamWriter::CZipStreamWriter(CZipOutputStream &output, bool isUtf8 /*= false*/, int level /*= -1*/) : output(output),
+isUtf8(isUtf8), level(level), closed(false), failed(false), inEntry(false), offset(0), stream(NULL)
+{
+	deflateBuffer.resize(STREAM_BUFFER_SIZE);
+}
+
+CZipStreamWriter::~CZipStreamWriter(void)
+{
+	close();
+
+	if (stream)
+	{
+		deflateEnd(stream);
+		delete stream;
+	}
+}
+
+bool CZipStreamWriter::fail(void)
+{
+	failed = true;
+	return false;
+}
+
+bool CZipStreamWriter::emit(const void *data, size_t length)
+{
+	if (failed)
+		return false;
+
+	buffer.append((const char *)data, length);
+	offset += length;
+
+	if (buffer.size() >= STREAM_BUFFER_SIZE)
+		return flush();
+
+	return true;
+}
+
+bool CZipStreamWriter::flush(void)
+{
+	if (failed)
+		return false;
+
+	if (!buffer.empty())
+	{
+		if (!output.write(buffer.data(), buffer.size()))
+			return fail();
+		buffer.clear();
+	}
+
+	if (!output.flush())
+		return fail();
+
+	return true;
+}
+
+bool CZipStreamWriter::writeLocalHeader(Record &record)
+{
+	string header;
+	ZipPut32(header, ZIP_LOCAL_HEADER_SIG);
+	ZipPut16(header, record.zip64 ? ZIP_VERSION_ZIP64 : ZIP_VERSION_DEFAULT);
+	ZipPut16(header, record.flags);
+	ZipPut16(header, record.method);
+	ZipPut16(header, record.dosTime);
+	ZipPut16(header, record.dosDate);
+	ZipPut32(header, 0);    //crc and sizes follow in the data descriptor
+	ZipPut32(header, record.zip64 ? ZIP_UINT32_LIMIT : 0);
+	ZipPut32(header, record.zip64 ? ZIP_UINT32_LIMIT : 0);
+	ZipPut16(header, (zip_uint16_t)record.name.size());
+	ZipPut16(header, record.zip64 ? 20 : 0);
+	header.append(record.name);
+
+	if (record.zip64)
+	{
+		ZipPut16(header, ZIP64_EXTRA_ID);
+		ZipPut16(header, 16);
+		ZipPut64(header, 0);
+		ZipPut64(header, 0);
+	}
+
+	return emit(header);
+}
+
+bool CZipStreamWriter::addDirectory(const string &rawName, time_t time)
+{
+	Record record;
+	record.name = rawName;
+	record.offset = offset;
+	record.size = 0;
+	record.sizeComp = 0;
+	record.crc = 0;
+	record.method = ZIP_METHOD_STORE;
+	record.flags = 0;
+	record.zip64 = false;
+	record.directory = true;
+	ZipTimeToDos(time, record.dosDate, record.dosTime);
+
+	if (isUtf8)
+	{
+		for (string::size_type i = 0; i < rawName.size(); ++i)
+		{
+			if ((unsigned char)rawName[i] >= 0x80)
+			{
+				record.flags |= ZIP_FLAG_UTF8;
+				break;
+			}
+		}
+	}
+
+	if (!writeLocalHeader(record))
+		return false;
+
+	records.push_back(record);
+	names.insert(rawName);
+	return true;
+}
+
+bool CZipStreamWriter::addParents(const string &entryName, time_t time)
+{
+	string::size_type nextSlash = entryName.find(DIRECTORY_SEPARATOR);
+	while (nextSlash != string::npos && nextSlash + 1 < entryName.size())
+	{
+		string pathToCreate = entryName.substr(0, nextSlash + 1);
+		string rawName = AsciiToUtf8(pathToCreate);
+		if (names.find(rawName) == names.end())
+		{
+			if (!addDirectory(rawName, time))
+				return false;
+		}
+		nextSlash = entryName.find(DIRECTORY_SEPARATOR, nextSlash + 1);
+	}
+	return true;
+}
+
+bool CZipStreamWriter::addEntry(const string &entryName, time_t time)
+{
+	if (!isOpen() || inEntry)
+		return false;
+
+	if (!IS_DIRECTORY(entryName))
+		return false;
+
+	if (time == 0)
+		time = ::time(NULL);
+
+	if (!addParents(entryName, time))
+		return false;
+
+	string rawName = AsciiToUtf8(entryName);
+	if (names.find(rawName) != names.end())
+		return true;
+
+	if (rawName.size() > ZIP_UINT16_LIMIT)
+		return false;
+
+	return addDirectory(rawName, time);
+}
+
+bool CZipStreamWriter::beginEntry(const string &entryName, time_t time, zip_int64_t sizeHint)
+{
+	if (!isOpen() || inEntry)
+		return false;
+
+	if (entryName.empty() || IS_DIRECTORY(entryName))
+		return false;
+
+	if (time == 0)
+		time = ::time(NULL);
+
+	string rawName = AsciiToUtf8(entryName);
+	if (rawName.size() > ZIP_UINT16_LIMIT)
+		return false;
+
+	if (names.find(rawName) != names.end())
+		return false;    //entries can't be replaced once they were written
+
+	if (!addParents(entryName, time))
+		return false;
+
+	Record record;
+	record.name = rawName;
+	record.offset = offset;
+	record.size = 0;
+	record.sizeComp = 0;
+	record.crc = crc32(0L, Z_NULL, 0);
+	record.method = ZIP_METHOD_DEFLATE;
+	record.flags = ZIP_FLAG_DATA_DESCRIPTOR;
+	record.directory = false;
+	ZipTimeToDos(time, record.dosDate, record.dosTime);
+
+	if (isUtf8)
+	{
+		for (string::size_type i = 0; i < rawName.size(); ++i)
+		{
+			if ((unsigned char)rawName[i] >= 0x80)
+			{
+				record.flags |= ZIP_FLAG_UTF8;
+				break;
+			}
+		}
+	}
+
+	if (stream == NULL)
+	{
+		stream = new z_stream;
+		memset(stream, 0, sizeof(z_stream));
+		if (deflateInit2(stream, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		{
+			delete stream;
+			stream = NULL;
+			return false;
+		}
+	}
+	else if (deflateReset(stream) != Z_OK)
+	{
+		return fail();
+	}
+
+	// incompressible data grows by the stored block overhead, deflateBound gives the worst case;
+	// uLong is 32 bits on Windows, a bound smaller than the input means it wrapped
+	record.zip64 = sizeHint < 0 || (zip_uint64_t)sizeHint >= ZIP_UINT32_LIMIT;
+	if (!record.zip64)
+	{
+		uLong bound = deflateBound(stream, (uLong)sizeHint);
+		record.zip64 = bound < (uLong)sizeHint || (zip_uint64_t)bound >= ZIP_UINT32_LIMIT;
+	}
+
+	if (!writeLocalHeader(record))
+		return false;
+
+	records.push_back(record);
+	inEntry = true;
+	return true;
+}
+
+bool CZipStreamWriter::deflateData(const void *data, size_t length, int flush)
+{
+	stream->next_in = (Bytef *)data;
+	stream->avail_in = (uInt)length;
+
+	int result;
+	do
+	{
+		stream->next_out = (Bytef *)&deflateBuffer[0];
+		stream->avail_out = (uInt)deflateBuffer.size();
+		result = deflate(stream, flush);
+		if (result == Z_STREAM_ERROR)
+			return fail();
+
+		size_t produced = deflateBuffer.size() - stream->avail_out;
+		if (produced > 0 && !emit(&deflateBuffer[0], produced))
+			return false;
+	}
+	while (stream->avail_out == 0 || (flush == Z_FINISH && result != Z_STREAM_END));
+
+	return true;
+}
+
+bool CZipStreamWriter::writeData(const void *data, size_t length)
+{
+	if (!isOpen() || !inEntry)
+		return false;
+
+	Record &record = records.back();
+	const Bytef *bytes = (const Bytef *)data;
+	while (length > 0)
+	{
+		size_t chunk = length > 0x40000000 ? 0x40000000 : length;
+		record.crc = crc32(record.crc, bytes, (uInt)chunk);
+		record.size += chunk;
+		if (!deflateData(bytes, chunk, Z_NO_FLUSH))
+			return false;
+
+		bytes += chunk;
+		length -= chunk;
+	}
+	return true;
+}
+
+bool CZipStreamWriter::endEntry(void)
+{
+	if (!isOpen() || !inEntry)
+		return false;
+
+	inEntry = false;
+	Record &record = records.back();
+	zip_uint64_t dataStart = record.offset + ZIP_LOCAL_HEADER_SIZE + record.name.size() + (record.zip64 ? 20 : 0);
+	if (!deflateData(NULL, 0, Z_FINISH))
+		return false;
+
+	record.sizeComp = offset - dataStart;
+	if (!record.zip64 && (record.size >= ZIP_UINT32_LIMIT || record.sizeComp >= ZIP_UINT32_LIMIT))
+		return fail();    //the size hint was wrong, the local header can't be fixed anymore
+
+	string descriptor;
+	ZipPut32(descriptor, ZIP_DATA_DESCRIPTOR_SIG);
+	ZipPut32(descriptor, record.crc);
+	if (record.zip64)
+	{
+		ZipPut64(descriptor, record.sizeComp);
+		ZipPut64(descriptor, record.size);
+	}
+	else
+	{
+		ZipPut32(descriptor, (zip_uint32_t)record.sizeComp);
+		ZipPut32(descriptor, (zip_uint32_t)record.size);
+	}
+
+	names.insert(record.name);
+	return emit(descriptor);
+}
+
+bool CZipStreamWriter::addData(const string &entryName, const void *data, zip_uint64_t length, time_t time)
+{
+	if (!beginEntry(entryName, time, (zip_int64_t)length))
+		return false;
+
+	const char *bytes = (const char *)data;
+	while (length > 0)
+	{
+		size_t chunk = length > 0x40000000 ? 0x40000000 : (size_t)length;
+		if (!writeData(bytes, chunk))
+			return false;
+
+		bytes += chunk;
+		length -= chunk;
+	}
+
+	return endEntry();
+}
+
+bool CZipStreamWriter::addFile(const string &entryName, const string &file)
+{
+	if (!isOpen() || inEntry)
+		return false;
+
+	HANDLE hFile = CreateFileA(file.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	FILETIME ftWrite;
+	if (!GetFileSizeEx(hFile, &fileSize) || !GetFileTime(hFile, NULL, NULL, &ftWrite))
+	{
+		CloseHandle(hFile);
+		return false;
+	}
+
+	LONGLONG ll = ((LONGLONG)ftWrite.dwHighDateTime << 32) | ftWrite.dwLowDateTime;
+	time_t fileTime = (time_t)((ll - 116444736000000000LL) / 10000000);
+
+	if (!beginEntry(entryName, fileTime, fileSize.QuadPart))
+	{
+		CloseHandle(hFile);
+		return false;
+	}
+
+	vector<char> data(STREAM_BUFFER_SIZE);
+	DWORD dwRead = 0;
+	bool result = true;
+	while (ReadFile(hFile, &data[0], (DWORD)data.size(), &dwRead, NULL) && dwRead > 0)
+	{
+		if (!writeData(&data[0], dwRead))
+		{
+			result = false;
+			break;
+		}
+	}
+	CloseHandle(hFile);
+
+	// endEntry has to run even after a failed write so the writer leaves the entry
+	bool ended = endEntry();
+	return result && ended;
+}
+
+void CZipStreamWriter::setComment(const string &comment)
+{
+	this->comment = AsciiToUtf8(comment);
+	if (this->comment.size() > ZIP_UINT16_LIMIT)
+		this->comment.resize(ZIP_UINT16_LIMIT);
+}
+
+bool CZipStreamWriter::writeCentralDirectory(void)
+{
+	zip_uint64_t centralOffset = offset;
+
+	vector<Record>::const_iterator it;
+	for (it = records.begin(); it != records.end(); ++it)
+	{
+		const Record &record = *it;
+		bool sizeOverflow = record.size >= ZIP_UINT32_LIMIT;
+		bool compOverflow = record.sizeComp >= ZIP_UINT32_LIMIT;
+		bool offsetOverflow = record.offset >= ZIP_UINT32_LIMIT;
+
+		string extra;
+		if (sizeOverflow || compOverflow || offsetOverflow)
+		{
+			string fields;
+			if (sizeOverflow)
+				ZipPut64(fields, record.size);
+			if (compOverflow)
+				ZipPut64(fields, record.sizeComp);
+			if (offsetOverflow)
+				ZipPut64(fields, record.offset);
+
+			ZipPut16(extra, ZIP64_EXTRA_ID);
+			ZipPut16(extra, (zip_uint16_t)fields.size());
+			extra.append(fields);
+		}
+
+		zip_uint16_t version = (record.zip64 || !extra.empty()) ? ZIP_VERSION_ZIP64 : ZIP_VERSION_DEFAULT;
+
+		string header;
+		ZipPut32(header, ZIP_CENTRAL_HEADER_SIG);
+		ZipPut16(header, ZIP_VERSION_ZIP64);    //made by MS-DOS, version 4.5
+		ZipPut16(header, version);
+		ZipPut16(header, record.flags);
+		ZipPut16(header, record.method);
+		ZipPut16(header, record.dosTime);
+		ZipPut16(header, record.dosDate);
+		ZipPut32(header, record.crc);
+		ZipPut32(header, compOverflow ? ZIP_UINT32_LIMIT : (zip_uint32_t)record.sizeComp);
+		ZipPut32(header, sizeOverflow ? ZIP_UINT32_LIMIT : (zip_uint32_t)record.size);
+		ZipPut16(header, (zip_uint16_t)record.name.size());
+		ZipPut16(header, (zip_uint16_t)extra.size());
+		ZipPut16(header, 0);    //comment
+		ZipPut16(header, 0);    //disk number
+		ZipPut16(header, 0);    //internal attributes
+		ZipPut32(header, record.directory ? FILE_ATTRIBUTE_DIRECTORY : 0);
+		ZipPut32(header, offsetOverflow ? ZIP_UINT32_LIMIT : (zip_uint32_t)record.offset);
+		header.append(record.name);
+		header.append(extra);
+
+		if (!emit(header))
+			return false;
+	}
+
+	zip_uint64_t centralSize = offset - centralOffset;
+	zip_uint64_t count = records.size();
+
+	string end;
+	CZipDirectory::appendEnd(end, count, centralOffset, centralSize, comment);
+	return emit(end);
+}
+
+bool CZipStreamWriter::close(void)
+{
+	if (closed)
+		return !failed;
+
+	if (inEntry)
+		endEntry();
+
+	closed = true;
+	if (failed)
+		return false;
+
+	if (!writeCentralDirectory())
+		return false;
+
+	return flush();
+}
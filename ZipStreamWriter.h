@@ -0,0 +1,111 @@
+#ifndef ZIPSTREAMWRITER_H
+#define	ZIPSTREAMWRITER_H
+
+#include <ctime>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <zipconf.h>
+#include "UnicodeConv.h"
+#include "ZipStream.h"
+
+struct z_stream_s;
+
+/*
+ * 只向前写的zip写入器，不需要可定位的输出
+ * 添加条目时立即输出本地文件头、压缩数据和数据描述符，close时输出中央目录，
+ * 内存占用只有压缩缓冲区和每个条目的目录信息，适合写入管道和套接字
+ * 条目命名和编码规则与CZipArchive::addFile/addData相同
+ */
+class CZipStreamWriter
+{
+public:
+	// level为zlib压缩级别，-1为默认级别，0为不压缩
+	CZipStreamWriter(CZipOutputStream &output, bool isUtf8 = false, int level = -1);
+	virtual ~CZipStreamWriter(void);
+
+	// 添加目录条目，entryName必须是目录(以'/'结尾)
+	bool addEntry(const std::string &entryName, time_t time = 0);
+
+	// 添加数据
+	bool addData(const std::string &entryName, const void *data, zip_uint64_t length, time_t time = 0);
+
+	// 添加文件
+	bool addFile(const std::string &entryName, const std::string &file);
+
+	/*
+	 * 分段写入一个条目
+	 * sizeHint为预计的未压缩大小，未知时为-1(使用ZIP64数据描述符)
+	 */
+	bool beginEntry(const std::string &entryName, time_t time = 0, zip_int64_t sizeHint = -1);
+	bool writeData(const void *data, size_t length);
+	bool endEntry(void);
+
+	// 设置zip存档注释，在close前调用
+	void setComment(const std::string &comment);
+
+	// 输出中央目录并结束存档
+	bool close(void);
+
+	// 输出已缓冲的数据
+	bool flush(void);
+
+	bool isOpen(void) const
+	{
+		return !closed && !failed;
+	}
+
+	// 已输出的字节数
+	zip_uint64_t getBytesWritten(void) const
+	{
+		return offset;
+	}
+
+private:
+	struct Record
+	{
+		std::string name;
+		zip_uint64_t offset;
+		zip_uint64_t size;
+		zip_uint64_t sizeComp;
+		zip_uint32_t crc;
+		zip_uint16_t method;
+		zip_uint16_t flags;
+		zip_uint16_t dosDate;
+		zip_uint16_t dosTime;
+		bool zip64;
+		bool directory;
+	};
+
+	CZipOutputStream &output;
+	bool isUtf8;
+	int level;
+	bool closed;
+	bool failed;
+	bool inEntry;
+	zip_uint64_t offset;
+	std::string comment;
+	std::vector<Record> records;
+	std::set<std::string> names;
+	std::string buffer;
+	std::vector<char> deflateBuffer;
+	z_stream_s *stream;
+
+	bool addDirectory(const std::string &rawName, time_t time);
+	bool addParents(const std::string &entryName, time_t time);
+	bool writeLocalHeader(Record &record);
+	bool writeCentralDirectory(void);
+	bool deflateData(const void *data, size_t length, int flush);
+	bool emit(const void *data, size_t length);
+	bool emit(const std::string &data)
+	{
+		return emit(data.data(), data.size());
+	}
+	bool fail(void);
+
+	CZipStreamWriter(const CZipStreamWriter &);
+	CZipStreamWriter &operator=(const CZipStreamWriter &);
+};
+
+#endif